@@ -141,7 +141,7 @@ void free(void *p) {
             fusion(b);
         else {
             if(b->prev)
-                b->prev->prev = NULL;
+                b->prev->next = NULL;
             else
                 first_block = NULL;
             brk(b);
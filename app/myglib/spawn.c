@@ -0,0 +1,109 @@
+/*************************************************
+ *   Author: Ray Huang
+ *   Date  : 2017/8/20
+ *   Email : rayhuang@126.com
+ *   Desc  : posix_spawn
+ ************************************************/
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "sys_call.h"
+
+#define SPAWN_MAX_ACTIONS 16
+#define SPAWN_ACTION_CLOSE 1
+#define SPAWN_ACTION_DUP2 2
+
+/* must be the same as struct spawn_action in kernel */
+struct kspawn_action
+{
+  int type;
+  int fd;
+  int new_fd;
+};
+
+struct kspawn_actions
+{
+  int count;
+  struct kspawn_action actions[SPAWN_MAX_ACTIONS];
+};
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t * __file_actions)
+{
+  memset(__file_actions, 0, sizeof(*__file_actions));
+  return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t * __file_actions)
+{
+  if (__file_actions->__actions)
+    free(__file_actions->__actions);
+  memset(__file_actions, 0, sizeof(*__file_actions));
+  return 0;
+}
+
+/* append an action, the array is allocated on first use */
+static int spawn_add_action(posix_spawn_file_actions_t * __file_actions,
+                            int type, int fd, int new_fd)
+{
+  struct kspawn_action * actions;
+
+  if (fd < 0 || new_fd < 0)
+    return EBADF;
+
+  if (!__file_actions->__actions){
+    actions = malloc(sizeof(struct kspawn_action) * SPAWN_MAX_ACTIONS);
+    if (!actions)
+      return ENOMEM;
+    __file_actions->__actions = (struct __spawn_action *)actions;
+    __file_actions->__allocated = SPAWN_MAX_ACTIONS;
+  }
+  if (__file_actions->__used >= __file_actions->__allocated)
+    return ENOMEM;
+
+  actions = (struct kspawn_action *)__file_actions->__actions;
+  actions += __file_actions->__used++;
+  actions->type = type;
+  actions->fd = fd;
+  actions->new_fd = new_fd;
+  return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t * __file_actions,
+                                      int __fd)
+{
+  return spawn_add_action(__file_actions, SPAWN_ACTION_CLOSE, __fd, 0);
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t * __file_actions,
+                                     int __fd, int __newfd)
+{
+  return spawn_add_action(__file_actions, SPAWN_ACTION_DUP2, __fd, __newfd);
+}
+
+/* create a child running path directly, without copying our address space.
+ * envp and spawn attributes are not supported by kernel and ignored */
+int posix_spawn(pid_t * __pid, const char * __path,
+                const posix_spawn_file_actions_t * __file_actions,
+                const posix_spawnattr_t * __attrp,
+                char * const __argv[], char * const __envp[])
+{
+  struct kspawn_actions acts;
+  struct kspawn_actions * arg = NULL;
+  int ret;
+
+  if (__file_actions && __file_actions->__used){
+    acts.count = __file_actions->__used;
+    memcpy(acts.actions, __file_actions->__actions,
+           sizeof(struct kspawn_action) * acts.count);
+    arg = &acts;
+  }
+
+  ret = sys_call_4(SYS_CALL_SPAWN, __path, __argv, arg);
+  if (ret < 0)
+    return errno;
+  if (__pid)
+    *__pid = ret;
+  return 0;
+}
@@ -5,6 +5,8 @@ SECTION .text
     global __sys_call_3
     global __sys_call_4
     global __sys_call_5
+    global vfork
+    extern __errno_location
 
 __sys_call_1:
     push ebp
@@ -43,6 +45,25 @@ __sys_call_3:
     pop ebp
     ret
 
+    ;; vfork: the child runs on our stack until it exec or exit, and it may
+    ;; overwrite anything below the caller's frame, so the return address is
+    ;; kept in ecx, which is saved by kernel for each task
+vfork:
+    pop ecx
+    mov eax, 9                  ;SYS_CALL_VFORK
+    int 0x80
+    push ecx
+    cmp eax, 0
+    jge .vfork_ret
+    neg eax
+    push eax
+    call __errno_location
+    pop ecx
+    mov [eax], ecx
+    mov eax, -1
+.vfork_ret:
+    ret
+
 __sys_call_4:
     push ebp
     mov ebp, esp
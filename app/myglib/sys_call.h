@@ -17,6 +17,8 @@
 #define SYS_CALL_BRK  6
 #define SYS_CALL_GETPID 7
 #define SYS_CALL_CHDIR 8
+#define SYS_CALL_VFORK 9
+#define SYS_CALL_SPAWN 50
 
 #define SYS_CALL_OPEN 10
 #define SYS_CALL_READ 11
@@ -37,6 +39,10 @@
 #define SYS_CALL_FCNTL 26
 
 #define SYS_CALL_USLEEP 30
+#define SYS_CALL_MMAP 35
+#define SYS_CALL_MUNMAP 36
+#define SYS_CALL_MPROTECT 37
+#define SYS_CALL_MADVISE 38
 
 #define SYS_CALL_PIPE 40
 #define SYS_CALL_SIGNAL 41
@@ -8,6 +8,7 @@
 #include "sys_call.h"
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 
 pid_t fork()
@@ -50,6 +51,45 @@ int brk(void *addr)
   return sys_call_2(SYS_CALL_BRK, addr);
 }
 
+//same layout as struct mmap_arg of kernel
+struct mmap_arg
+{
+  unsigned long addr;
+  unsigned long len;
+  int prot;
+  int flags;
+  int fd;
+  unsigned long offset;
+};
+
+void *mmap(void *__addr, size_t __len, int __prot, int __flags, int __fd, __off_t __offset)
+{
+  struct mmap_arg arg;
+
+  arg.addr = (unsigned long)__addr;
+  arg.len = __len;
+  arg.prot = __prot;
+  arg.flags = __flags;
+  arg.fd = __fd;
+  arg.offset = __offset;
+  return (void *)sys_call_2(SYS_CALL_MMAP, &arg);
+}
+
+int munmap(void *__addr, size_t __len)
+{
+  return sys_call_3(SYS_CALL_MUNMAP, __addr, __len);
+}
+
+int mprotect(void *__addr, size_t __len, int __prot)
+{
+  return sys_call_4(SYS_CALL_MPROTECT, __addr, __len, __prot);
+}
+
+int madvise(void *__addr, size_t __len, int __advice)
+{
+  return sys_call_4(SYS_CALL_MADVISE, __addr, __len, __advice);
+}
+
 int chdir(const char* __path)
 {
   return sys_call_2(SYS_CALL_CHDIR, __path);
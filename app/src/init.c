@@ -21,16 +21,16 @@ int main(int argc, char **argv)
 
   int i;
   for (i = 0; i < tty_max_num; i++){
-    shell = fork();
+    // the child only open its tty and exec, so it can borrow our memory
+    shell = vfork();
     if (shell < 0)
       return 1;
 
     if (shell == 0){
       if (ioctl(0, 2, 0) < 0) // open new tty
-        return 1;
+        _exit(1);
       execve("sbin/shell", NULL, NULL);
-      printf("can not execve shell\n");
-      return 1;
+      _exit(1);
     }
   }
 
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <spawn.h>
 
 #define BUFFER_LEN 4096
 #define CMD_NAME_LEN 128
@@ -185,25 +186,24 @@ pid_t run_task(char ** argv)
   if (!argv || !argv[0] || !argv[0][0])
     return 1;
 
-  pid_t child = fork();
-  if (child < 0)
+  pid_t child;
+  int err;
+
+  if ((argv[0][0] == '.' && argv[0][1] =='/')
+      ||
+      (argv[0][0] == '.' && argv[0][1] == '.' && argv[0][2] == '/')
+      ||
+      (argv[0][0] == '/'))
+    strcpy(cmd_name, argv[0]);
+  else
+    //we use default PATH = /bin/
+    sprintf(cmd_name, "/bin/%s", argv[0]);
+
+  // spawn the command directly, there is no need to copy our address space
+  err = posix_spawn(&child, cmd_name, NULL, NULL, argv, environ);
+  if (err){
+    errno = err;
     return -1;
-  if (!child){
-    if ((argv[0][0] == '.' && argv[0][1] =='/')
-        ||
-        (argv[0][0] == '.' && argv[0][1] == '.' && argv[0][2] == '/')
-        ||
-        (argv[0][0] == '/'))
-      strcpy(cmd_name, argv[0]);
-    else
-      //we use default PATH = /bin/
-      sprintf(cmd_name, "/bin/%s", argv[0]);
-
-    execve(cmd_name, argv, environ);
-    char buffer[32];
-    sprintf(buffer, "can not execve %s", argv[0]);
-    perror(buffer);
-    exit(1);
   }
   return child;
 }
@@ -1,7 +1,37 @@
-    ;; since we will into real mode,BIOS can not be used any more
+    E820_COUNT_ADDR equ 0x9000
+    E820_MAP_ADDR   equ 0x9004
+    E820_MAX_NUM    equ 32
+    E820_ENTRY_SIZE equ 20
+    E820_SMAP       equ 0x534d4150
+
     xor ax, ax
     mov ss, ax
+    mov sp, 0x7c00
 
+    ;; collect physical memory map by BIOS E820
+    ;; start.asm will copy it from E820_MAP_ADDR
+    mov ds, ax
+    mov es, ax
+    mov dword [E820_COUNT_ADDR], 0
+    mov di, E820_MAP_ADDR
+    xor ebx, ebx
+e820_next:
+    mov eax, 0xe820
+    mov ecx, E820_ENTRY_SIZE
+    mov edx, E820_SMAP
+    int 0x15
+    jc e820_done
+    cmp eax, E820_SMAP
+    jne e820_done
+    inc dword [E820_COUNT_ADDR]
+    add di, E820_ENTRY_SIZE
+    cmp dword [E820_COUNT_ADDR], E820_MAX_NUM
+    jae e820_done
+    test ebx, ebx
+    jnz e820_next
+e820_done:
+
+    ;; since we will into real mode,BIOS can not be used any more
     ;; 0. set up GDT
 
     mov ax, 0
@@ -57,7 +87,7 @@ flush:
     mov esp, 0x10000 + 0x1000
 
     mov ecx, 1024
-    mov ebx, 0x100000
+    mov ebx, 0x400000
     mov eax, 2049
 read_kernel:
     push ebx    ;buffer address
@@ -192,4 +222,4 @@ readw:
 ;; gdt_infor----------------------------------------------------------
     gdt_size    dw 0
     gdt_base    dd 0x00007c00 + 2048
-    kernel_address dd 0x000100000
+    kernel_address dd 0x000400000
@@ -346,8 +346,8 @@ irq_common_ret:
     mov eax, [esp + 48]
 	cmp eax, 0x10
     je skip_check
-    call sig_check_signal
 	call task_check_schedule
+    call sig_check_signal
 skip_check:
     RESTOR_REGS
     add esp, 8
@@ -23,7 +23,27 @@ void mmu_init()
   int i;
   for (i = 0; i < KERNEL_VMM_START / (4 * 10240 * 1024); i++)
     pdt[i] = 0;
+  mmu_flush();
+}
+
+/*
+ * Flush tlb of "start" ~ "end" after a batch of map changes.
+ * Small range is flushed by invlpg page by page, otherwise the whole tlb is flushed,
+ * include global pages if the range is in kernel space.
+ */
+void mmu_flush_range(unsigned long start, unsigned long end)
+{
+  unsigned long addr;
 
+  if ((end - start) >> PAGE_SHIFT > MMU_FLUSH_PAGES_MAX){
+    if (end > KERNEL_VMM_START)
+      mmu_flush_global();
+    else
+      mmu_flush();
+    return ;
+  }
+  for (addr = PAGE_ALIGN(start); addr < end; addr += PAGE_SIZE)
+    mmu_flush_page(addr);
 }
 
 int mmu_map(unsigned long pdt, unsigned long vaddr,unsigned long paddr, unsigned long rw)
@@ -36,10 +56,9 @@ int mmu_map(unsigned long pdt, unsigned long vaddr,unsigned long paddr, unsigned
 
   pdt_e = get_pdt_entry(pdt, vaddr);
   if (!pdt_e){
-    new_pet_table = (uint32)mm_kmalloc(PAGE_SIZE);
+    new_pet_table = (uint32)mm_alloc_zero_page();
     if (!new_pet_table)
       return 1;
-    memset((void *)new_pet_table, 0, PAGE_SIZE);
     new_pet_table = vaddr_to_paddr(new_pet_table);
     pdt_e = make_pdt(new_pet_table, 1);
     set_pdt_entry(pdt, vaddr, pdt_e);
@@ -48,6 +67,41 @@ int mmu_map(unsigned long pdt, unsigned long vaddr,unsigned long paddr, unsigned
   pet_e = make_pet(paddr, rw);
   pet_table_vaddr = paddr_to_vaddr(get_pet_addr(pdt_e));
   set_pet_entry(pet_table_vaddr, vaddr,  pet_e);
-  mmu_flush();
+  mmu_flush_page(vaddr);
   return 0;
 }
+
+/*
+ * Map a page of kernel space above the direct map.
+ * Pet table must have been set up in the pdt of kernel, and it is shared by the
+ * pdt of all tasks, so the new map is seen by all tasks.
+ * Return 0 if successful or return 1 if there is no pet table.
+ */
+int mmu_map_kernel(unsigned long vaddr, unsigned long paddr)
+{
+  uint32 pdt_e = get_pdt_entry(INIT_PDT_TABLE_START, vaddr);
+
+  if (!pdt_e)
+    return 1;
+  set_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), vaddr, make_kernel_pet(PAGE_ALIGN(paddr)));
+  return 0;
+}
+
+/*
+ * Remove the map of a page.
+ * Return physical address of the page that was mapped, or return 0 if no map.
+ *
+ * Note: mmu_flush_range should be called after unmap.
+ */
+unsigned long mmu_unmap(unsigned long pdt, unsigned long vaddr)
+{
+  uint32 pdt_e = get_pdt_entry(pdt, vaddr);
+  uint32 pet_e, pet_table_vaddr;
+
+  if (!pdt_e)
+    return 0;
+  pet_table_vaddr = paddr_to_vaddr(get_pet_addr(pdt_e));
+  pet_e = get_pet_entry(pet_table_vaddr, vaddr);
+  set_pet_entry(pet_table_vaddr, vaddr, 0);
+  return pet_present(pet_e) ? get_page_addr(pet_e) : 0;
+}
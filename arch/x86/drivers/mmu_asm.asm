@@ -3,6 +3,8 @@
     global mmu_page_fault_addr
     global mmu_set_page_table
     global mmu_flush
+    global mmu_flush_page
+    global mmu_flush_global
 mmu_page_fault_addr:
     mov eax, cr2
     ret
@@ -26,3 +28,22 @@ mmu_flush:
     mov cr3, eax
     pop eax
     ret
+
+    ;; void mmu_flush_page(unsigned long vaddr)
+mmu_flush_page:
+    push eax
+    mov eax, [esp + 8]
+    invlpg [eax]
+    pop eax
+    ret
+
+    ;; reload cr3 can not flush global pages, but toggling PGE can
+mmu_flush_global:
+    push eax
+    mov eax, cr4
+    and eax, ~0x80
+    mov cr4, eax
+    or eax, 0x80
+    mov cr4, eax
+    pop eax
+    ret
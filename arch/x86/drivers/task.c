@@ -55,3 +55,23 @@ void task_arch_init_run_context(struct task * task, unsigned long ret_val)
   frame->eflags = 0x92;
   task->cur_stack = (unsigned long)frame;
 }
+
+/*
+ * Setup the first run context of a task that has not been in user space.
+ * The task will start at "start_addr" of user space with user stack "stack", just
+ * like task_arch_launch, when it is scheduled for the first time.
+ */
+void task_arch_init_user_context(struct task * task, unsigned long start_addr, unsigned long stack)
+{
+  struct pt_regs * regs = (struct pt_regs *)(task->kernel_stack - sizeof(*regs));
+
+  memset(regs, 0, sizeof(*regs));
+  regs->ds = GDT_USER_DS;
+  regs->es = GDT_USER_DS;
+  regs->ss = GDT_USER_DS;
+  regs->cs = GDT_USER_CS;
+  regs->eip = start_addr;
+  regs->esp = stack;
+  regs->eflags = 0x202;
+  task_arch_init_run_context(task, 0);
+}
@@ -16,6 +16,17 @@
 #define __ARCH_ASM_H
 
 #define system_hlt() asm("hlt")
+
+//index of the lowest/highest set bit, "word" must not be zero
+#define arch_bsf(word) ({                                               \
+      unsigned long __ret;                                              \
+      asm("bsf %1, %0" : "=r"(__ret) : "rm"((unsigned long)(word)));    \
+      __ret;})
+#define arch_bsr(word) ({                                               \
+      unsigned long __ret;                                              \
+      asm("bsr %1, %0" : "=r"(__ret) : "rm"((unsigned long)(word)));    \
+      __ret;})
+
 extern unsigned  int pio_in8(unsigned int address);
 extern void pio_out8(unsigned int value, unsigned int address);
 extern void pio_out16(unsigned int value, unsigned int address);
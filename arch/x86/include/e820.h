@@ -0,0 +1,36 @@
+/*
+ *  Physical memory map from BIOS E820
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/7/30 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __ARCH_E820_H
+#define __ARCH_E820_H
+
+#include <arch/system.h>
+
+#define E820_MAX_NUM 32
+#define E820_TYPE_RAM 1
+
+struct e820_entry
+{
+  uint32 base_low;
+  uint32 base_high;
+  uint32 len_low;
+  uint32 len_high;
+  uint32 type;
+};
+
+//collected by boot.asm and copied by start.asm
+extern uint32 boot_e820_count;
+extern struct e820_entry boot_e820_map[E820_MAX_NUM];
+
+#endif /* __ARCH_E820_H */
@@ -19,6 +19,8 @@
 #include <arch/regs.h>
 
 #define PDT_MAX_NUM (PAGE_SIZE / 4)
+//mmu_flush_range flush page by page up to this, and flush all for more
+#define MMU_FLUSH_PAGES_MAX 32
 #define PET_MAX_NUM (PAGE_SIZE / 4)
 #define USER_SPACE_PDT_MAX_NUM (256 * 3)
 
@@ -41,6 +43,24 @@
 #define make_pet(page_addr, rw) \
   (page_addr | (rw << 1) | 0x5)
 
+//pdt entry of a 4MB page
+#define make_large_pdt(page_addr, rw) \
+  (page_addr | 0x80 | (rw << 1) | 0x5)
+
+#define pdt_large(pdt_e) \
+  (pdt_e & 0x80)
+
+#define get_large_page_addr(pdt_e) \
+  (pdt_e & ~(LARGE_PAGE_SIZE - 1))
+
+//entries of kernel space, can not be accessed by user
+//kernel pages are global, so they are kept in tlb when cr3 is changed
+#define make_kernel_pdt(pet_table_addr) \
+  (pet_table_addr | 0x3)
+
+#define make_kernel_pet(page_addr) \
+  (page_addr | 0x103)
+
 #define get_pet_addr(pdt_e) \
   (pdt_e & ~(0xfff))
 
@@ -61,9 +81,30 @@
 #define pet_present(pet_e)\
   (pet_e & 0x1)
 
+#define pet_accessed(pet_e)\
+  (pet_e & 0x20)
+
+#define clr_accessed(pet_e)\
+  (pet_e &= ~0x20)
+
+//pet entry of a swapped out page, it is not present, and keeps slot and rw bit
+#define make_swap_pet(slot, rw) \
+  (((slot) << PAGE_SHIFT) | 0x400 | (rw << 1))
+
+#define pet_swapped(pet_e) \
+  (!pet_present(pet_e) && (pet_e & 0x400))
+
+#define get_swap_slot(pet_e) \
+  (pet_e >> PAGE_SHIFT)
+
 int mmu_map(unsigned long pdt, unsigned long vaddr, unsigned long paddr, unsigned long rw);
+int mmu_map_kernel(unsigned long vaddr, unsigned long paddr);
+unsigned long mmu_unmap(unsigned long pdt, unsigned long vaddr);
 void mmu_init();
 void mmu_flush();
+void mmu_flush_page(unsigned long vaddr);
+void mmu_flush_global();
+void mmu_flush_range(unsigned long start, unsigned long end);
 uint32 mmu_page_fault_addr();
 void mmu_set_page_table(uint32 addr);
 
@@ -26,8 +26,10 @@ typedef unsigned int size_t;
 #define  NULL (void *)0
 
 //========= MM MAP ================================/
-#define PHY_MM_START 0x100000
-#define PHY_MM_SIZE  (1024 * 1024 *124)
+#define PHY_MM_START 0x400000 //4MB aligned, so that direct map can use 4MB pages
+#define PHY_MM_MAX_SIZE (1024 * 1024 * 896) //the most we can map in kernel space
+#define PHY_MM_SIZE  boot_phy_mm_size //found out by start.asm from E820 map
+extern unsigned long boot_phy_mm_size;
 
 #define PAGE_SIZE  (4 * 1024)
 #define PAGE_SHIFT 12
@@ -35,7 +37,19 @@ typedef unsigned int size_t;
 #define PAGE_ALIGN(addr)  ((unsigned long)(addr) & ~0xfff)
 #define PAGE_OFFSET(addr) ((unsigned long)(addr) & 0xfff)
 
+//4MB page of PSE, one pdt entry maps it without pet table
+#define LARGE_PAGE_SIZE (4 * 1024 * 1024)
+#define LARGE_PAGE_SHIFT 22
+#define LARGE_PAGE_NUM (LARGE_PAGE_SIZE / PAGE_SIZE)
+#define LARGE_PAGE_ALIGN(addr) ((unsigned long)(addr) & ~(LARGE_PAGE_SIZE - 1))
+
+#define CACHE_LINE_SIZE 64
+
 #define KERNEL_VMM_START 0xc0000000
+//kernel virtual space for vmalloc, above the most direct map of RAM
+#define VMALLOC_START (KERNEL_VMM_START + PHY_MM_MAX_SIZE)
+#define VMALLOC_SIZE (64 * 1024 * 1024)
+#define VMALLOC_END (VMALLOC_START + VMALLOC_SIZE)
 #define KERNEL_SIZE 0x400000
 #define KERNEL_END KERNEL_VMM_START + KERNEL_SIZE
 //--- 0xc0000000 + 4MB
@@ -47,8 +61,9 @@ typedef unsigned int size_t;
 #define INIT_PDT_TABLE_START (VGA_VMM_START + VGA_SIZE)
 
 //----0xc0000000 + 4MB + 1KB + 1KB
+//direct map use 4MB pages, only the 4MB after kernel has pet table for VGA
 #define INIT_PET_TABLES_START (INIT_PDT_TABLE_START + PAGE_SIZE)
-#define INIT_PET_TABLES_NUM (PHY_MM_SIZE / (4*1024*1024))
+#define INIT_PET_TABLES_NUM 1
 
 //----0xc0000000 + 4MB + 1KB + 1KB + INIT_PET_TABLES_NUM * PAGE_SIZE
 #define __FREE_VMM_START (INIT_PET_TABLES_START + INIT_PET_TABLES_NUM * PAGE_SIZE)
@@ -56,9 +71,6 @@ typedef unsigned int size_t;
 
 #define FREE_PMM_START (FREE_VMM_START - KERNEL_VMM_START + PHY_MM_START)
 
-//total num of free page
-#define FREE_PAGE_TOTAL ((PHY_MM_START +  PHY_MM_SIZE - FREE_PMM_START) / PAGE_SIZE)
-
 //===================   GDT   ========================
 #define GDT_BASE (KERNEL_END - PAGE_SIZE)
 #define GDT_KERNEL_CS 0x10
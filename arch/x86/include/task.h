@@ -35,6 +35,7 @@ void task_arch_launch(unsigned long start_addr, unsigned long stack);
 void task_arch_init();
 void task_arch_befor_launch(struct task * task);
 void task_arch_init_run_context(struct task * task, unsigned long ret_val);
+void task_arch_init_user_context(struct task * task, unsigned long start_addr, unsigned long stack);
 void task_arch_switch_to(struct task * pre, struct task *next);
 
 #endif /* __ARCH_TASK_H */
@@ -2,10 +2,11 @@
 SECTION .start
 
     PAGE_SIZE         equ 0x1000
-    PHY_START_ADDRESS equ 0x100000 ;1MB not used
-    PHY_SIZE          equ 0x100000 * 124 ;124MB
+    PHY_START_ADDRESS equ 0x400000 ;4MB not used, so that direct map can use 4MB pages
+    PHY_DEFAULT_SIZE  equ 0x100000 * 124 ;124MB, used when there is no E820 map
+    PHY_MAX_SIZE      equ 0x100000 * 896 ;896MB, the most we can map in kernel space
     KERNEL_SIZE       equ 0x400000 ;4MB kernel
-    KERNEL_PHY_START  equ 0x100000
+    KERNEL_PHY_START  equ 0x400000
     KERNEL_PHY_END    equ PHY_START_ADDRESS + KERNEL_SIZE
 
 
@@ -21,6 +22,9 @@ SECTION .start
     PET_TABLES_START        equ PDT_TABLE_START + PAGE_SIZE
     PER_PET_PAGE_MM_SIZE    equ 0x400000
     PER_PDT_ENTRY_MM_SIZE   equ PER_PET_PAGE_MM_SIZE
+    PDT_LARGE_KERNEL        equ 0x183 ;4MB page, global, kernel only, writeable
+    PDT_LARGE_LOW           equ 0x83 ;identity map is removed later, so not global
+    PET_KERNEL              equ 0x103 ;global, kernel only, writeable
 
     VMM_START_ADDRESS   equ 0xc0000000
 
@@ -29,8 +33,21 @@ SECTION .start
 
     INIT_STACK_SIZE equ 4096 * 2
 
+    ;; left by boot.asm
+    E820_COUNT_ADDR equ 0x9000
+    E820_MAP_ADDR   equ 0x9004
+    E820_MAX_NUM    equ 32
+    E820_ENTRY_SIZE equ 20
+    E820_TYPE_RAM   equ 1
+
+    ;; paging is not open yet, so we can only use physical address of kernel symbols
+    %define PHY(addr) ((addr) - VMM_START_ADDRESS + KERNEL_PHY_START)
+
 global gdt_size
 global gdt_tables
+global boot_phy_mm_size
+global boot_e820_count
+global boot_e820_map
 
 extern kernel_start
 extern init_stack_space
@@ -42,16 +59,22 @@ extern __bss_end
 __start:
     ;; 0. init temp sp
     mov esp, 0x100000
-    ;; 1. init kernel page table
+    ;; 1. find out the size of physical memory
+    jmp init_mm_size
+init_mm_size_ok:
+    ;; 2. init kernel page table
     ;; eax = pdr address
     jmp  init_mmu_table
 init_mmu_ok:
-    ;; set cr3 and open PG
+    ;; enable 4MB pages (PSE) and global pages (PGE), set cr3 and open PG
+    mov ebx, cr4
+    or ebx, 0x90
+    mov cr4, ebx
     mov cr3, eax
     mov eax, cr0
     or eax, 0x80000000
     mov cr0, eax
-    ;; 2. init new gdt
+    ;; 3. init new gdt
     jmp init_gdt_table
 init_gdt_ok:
     ;; lgdt
@@ -86,6 +109,61 @@ jmp_to_kernel:
     mov eax, kernel_start
     jmp eax
 
+    ;; -------------------------------------------------------------------------------------------
+init_mm_size:
+    ;; copy the E820 map to boot_e820_map and find the end of usable memory
+    ;; edx = end of usable memory
+    cld
+    mov ecx, [E820_COUNT_ADDR]
+    cmp ecx, E820_MAX_NUM
+    jbe e820_count_ok
+    mov ecx, E820_MAX_NUM
+e820_count_ok:
+    mov [PHY(boot_e820_count)], ecx
+    mov esi, E820_MAP_ADDR
+    mov edi, PHY(boot_e820_map)
+    xor edx, edx
+e820_scan:
+    test ecx, ecx
+    jz e820_scan_ok
+    cmp dword [esi + 16], E820_TYPE_RAM
+    jne e820_copy
+    cmp dword [esi + 4], 0      ;above 4GB
+    jne e820_copy
+    mov eax, [esi]
+    add eax, [esi + 8]
+    jc e820_4g
+    cmp dword [esi + 12], 0
+    je e820_end
+e820_4g:
+    mov eax, 0xffffffff
+e820_end:
+    cmp eax, edx
+    jbe e820_copy
+    mov edx, eax
+e820_copy:
+    push ecx
+    mov ecx, E820_ENTRY_SIZE / 4
+    rep movsd
+    pop ecx
+    dec ecx
+    jmp e820_scan
+e820_scan_ok:
+    cmp edx, PHY_START_ADDRESS + KERNEL_SIZE
+    ja e820_check_max
+    mov edx, PHY_START_ADDRESS + PHY_DEFAULT_SIZE
+e820_check_max:
+    cmp edx, PHY_START_ADDRESS + PHY_MAX_SIZE
+    jbe e820_size_ok
+    mov edx, PHY_START_ADDRESS + PHY_MAX_SIZE
+e820_size_ok:
+    ;; size = end - PHY_START_ADDRESS, and round up to PER_PET_PAGE_MM_SIZE
+    sub edx, PHY_START_ADDRESS
+    add edx, PER_PET_PAGE_MM_SIZE - 1
+    and edx, ~(PER_PET_PAGE_MM_SIZE - 1)
+    mov [PHY(boot_phy_mm_size)], edx
+    jmp init_mm_size_ok
+
     ;; -------------------------------------------------------------------------------------------
 init_mmu_table:
     ;;init for PDT
@@ -104,56 +182,53 @@ clean_pdt:
     dec ecx
     jnz clean_pdt
 
+    ;; direct map, every pdt entry maps a 4MB page
    	mov ebx, PDT_TABLE_START + (VMM_START_ADDRESS / PER_PDT_ENTRY_MM_SIZE) * PDT_ENTRY_SIZE
-    mov eax, PET_TABLES_START
-    add eax, 0x3
-    mov ecx, PHY_SIZE / PER_PDT_ENTRY_MM_SIZE;how many PET page we need
+    mov eax, PHY_START_ADDRESS
+    add eax, PDT_LARGE_KERNEL
+    mov ecx, [PHY(boot_phy_mm_size)]
+    shr ecx, 22                 ;how many 4MB pages we need
 pdt_high_init:
     mov [ebx], eax
-    add eax, PAGE_SIZE
+    add eax, PER_PDT_ENTRY_MM_SIZE
     add ebx, PDT_ENTRY_SIZE
     dec ecx
     jnz pdt_high_init
 
+    ;; identity map of low memory, used until we jump to kernel_start
     mov ebx, PDT_TABLE_START
-    mov eax, (PHY_SIZE / PER_PDT_ENTRY_MM_SIZE) * PAGE_SIZE + PET_TABLES_START
-    add eax, 0x3
+    mov eax, 0
+    add eax, PDT_LARGE_LOW
     mov ecx, KERNEL_PHY_END / PER_PDT_ENTRY_MM_SIZE + 1
 
 pdt_low_init:
     mov [ebx], eax
-    add eax, PAGE_SIZE
+    add eax, PER_PDT_ENTRY_MM_SIZE
     add ebx, PDT_ENTRY_SIZE
     dec ecx
     jnz pdt_low_init
 
-    mov ebx, PET_TABLES_START
-    mov eax, PHY_START_ADDRESS
+    ;; the 4MB after kernel use small pages, since it's first page is taken by VGA
+    mov ebx, PDT_TABLE_START + ((VMM_START_ADDRESS + KERNEL_SIZE) / PER_PDT_ENTRY_MM_SIZE) * PDT_ENTRY_SIZE
+    mov eax, PET_TABLES_START
     add eax, 0x3
-    mov ecx, PHY_SIZE / PAGE_SIZE
-pet_high_init:
     mov [ebx], eax
-    add eax, PAGE_SIZE
-    add ebx, PET_ENTRY_SIZE
-    dec ecx
-    jnz pet_high_init
-
 
-    mov ebx, (PHY_SIZE / PER_PDT_ENTRY_MM_SIZE) * PET_TABLE_SIZE + PET_TABLES_START
-    mov eax, 0
-    add eax, 0x3
-    mov ecx, KERNEL_PHY_END / PAGE_SIZE
-pet_low_init:
+    mov ebx, PET_TABLES_START
+    mov eax, KERNEL_PHY_END
+    add eax, PET_KERNEL
+    mov ecx, PER_PET_PAGE_MM_SIZE / PAGE_SIZE
+pet_init:
     mov [ebx], eax
     add eax, PAGE_SIZE
     add ebx, PET_ENTRY_SIZE
     dec ecx
-    jnz pet_low_init
+    jnz pet_init
 
 vga_ptb_init:
-    mov ebx, PET_TABLES_START + (KERNEL_SIZE / PAGE_SIZE) * PET_ENTRY_SIZE
+    mov ebx, PET_TABLES_START
     mov eax, VGA_PHY_START
-    add eax, 0x3
+    add eax, PET_KERNEL
     mov [ebx], eax
 
 
@@ -208,3 +283,7 @@ init_gdt_table:
 
     idt_size dw 0
     idt_base dd 0
+
+    boot_phy_mm_size dd 0
+    boot_e820_count dd 0
+    boot_e820_map times E820_MAX_NUM * E820_ENTRY_SIZE db 0
@@ -107,6 +107,9 @@ struct kstat
 #define BUFFER_IS_DIRTY(buff) (buff->flag & BUFFER_DIRTY_MASK)
 #define BUFFER_SET_DIRTY(buff) (buff->flag |= BUFFER_DIRTY_MASK)
 #define BUFFER_CLER_DIRTY(buff) (buff->flag &= ~BUFFER_DIRTY_MASK)
+#define BUFFER_SHARED_MASK 0x2 //mapped by shared mmap, write file in place
+#define BUFFER_IS_SHARED(buff) (buff->flag & BUFFER_SHARED_MASK)
+#define BUFFER_SET_SHARED(buff) (buff->flag |= BUFFER_SHARED_MASK)
 
 
 #define fs_get_file(file) (file->count++)
@@ -114,7 +117,7 @@ struct kstat
 	do{\
 		file->count--;\
 		if (!file->count)\
-			slab_free_obj(file);\
+			fs_free_file(file);\
 	}while (0)
 
 #define fs_get_inode(inode) (inode->count++);
@@ -181,7 +184,9 @@ int fs_write(struct fs_file * file, char * buffer, unsigned long count);
 void fs_sync(struct fs_inode *file);
 off_t fs_seek(struct fs_file * file, off_t offset, int whence);
 struct fs_file * fs_new_file();
+void fs_free_file(struct fs_file * file);
 struct fs_inode * fs_new_inode();
 struct fs_data_buffer * fs_inode_get_buffer(struct fs_inode *inode, unsigned long buffer_offset);
+struct fs_data_buffer * fs_inode_find_buffer(struct fs_inode *inode, unsigned long buffer_offset);
 
 #endif /* __YATOS_FS_H */
@@ -0,0 +1,29 @@
+/*
+ *  LZ77 compressor
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/26 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __YATOS_LZ_H
+#define __YATOS_LZ_H
+
+#include <arch/system.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_INPUT 65536 //offset of a match is 16 bits
+
+unsigned long lz_compress(const unsigned char * src, unsigned long len,
+                          unsigned char * dst, unsigned long max_len);
+long lz_decompress(const unsigned char * src, unsigned long len,
+                   unsigned char * dst, unsigned long max_len);
+
+#endif /* __YATOS_LZ_H */
@@ -20,8 +20,10 @@
 #include <yatos/pmm.h>
 #include <yatos/slab.h>
 
-#define MAX_KMALLOC_SLAB_LEVE 11
-#define MIN_KMALLOC_SLAB_LEVE 4
+#define KMALLOC_CLASS_NUM 15
+#define KMALLOC_MAX_SIZE 3072
+#define KMALLOC_SIZE_GRAIN 16 //all kmalloc classes are multiple of this
+#define MM_ZERO_POOL_MAX 64
 
 #define paddr_to_vaddr(paddr) (KERNEL_VMM_START + ((paddr) - PHY_MM_START))
 #define paddr_to_page(paddr) pmm_paddr_to_page(paddr)
@@ -31,5 +33,8 @@
 void mm_init();
 void * mm_kmalloc(unsigned long size);
 void mm_kfree(void *addr);
+void * mm_alloc_zero_page();
+void * mm_alloc_zero_page_noreclaim();
+int mm_fill_zero_pool();
 
 #endif /* __YATOS_MM_H */
@@ -0,0 +1,56 @@
+/*
+ *  Memory map of user task.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/9 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __YATOS_MMAP_H
+#define __YATOS_MMAP_H
+
+#include <yatos/fs.h>
+
+//same as linux
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_HUGETLB 0x40000 //use 4MB pages, only for private anonymous mapping
+
+#define MADV_DONTNEED 4
+#define MADV_FREE 8
+
+//arguments of mmap, passed by pointer since we have only 3 sys_call args
+struct mmap_arg
+{
+  unsigned long addr;
+  unsigned long len;
+  int prot;
+  int flags;
+  int fd;
+  unsigned long offset;
+};
+
+//private data of file mapping areas, shared by areas split from the same mapping
+struct mmap_info
+{
+  unsigned long count;
+  struct fs_file * file;
+  unsigned long base; //file offset of address "addr" is "addr - base"
+};
+
+void mmap_init();
+
+#endif /* __YATOS_MMAP_H */
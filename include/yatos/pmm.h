@@ -17,14 +17,38 @@
 
 #include <arch/system.h>
 #include <yatos/list.h>
+#include <arch/e820.h>
 #include <yatos/mm.h>
 
-#define PMM_MAX_LEVE 32
-#define PMM_TOTAL_PAGE PHY_MM_SIZE / PAGE_SIZE
+//every 4MB of physical memory has it's own memmap, holes cost nothing
+#define PMM_SECTION_SHIFT 22
+#define PMM_SECTION_ORDER (PMM_SECTION_SHIFT - PAGE_SHIFT)
+#define PMM_SECTION_PAGES (1UL << PMM_SECTION_ORDER)
+#define PMM_SECTION_NUM (((PHY_MM_START + PHY_MM_MAX_SIZE) >> PMM_SECTION_SHIFT) + 1)
+
+//a buddy block never cross a section
+#define PMM_MAX_LEVE (PMM_SECTION_ORDER + 1)
+
+//reclaim starts when free pages below total/LOW and stops at total/HIGH
+#define PMM_LOW_WATERMARK_DIV 64
+#define PMM_HIGH_WATERMARK_DIV 32
+//every reserved E820 entry may split a usable range into two
+#define PMM_RANGE_MAX (E820_MAX_NUM * 2)
+
+//shrinker priority, lower one will be called first
+#define PMM_SHRINK_PRIO_POOL 0
+#define PMM_SHRINK_PRIO_CACHE 1
+#define PMM_SHRINK_PRIO_SLAB 2
+#define PMM_SHRINK_PRIO_SWAP 3
+
+//flag of pmm_alloc_pages
+#define PMM_ALLOC_NORECLAIM 1 //fail at once instead of reclaim, for optional memory
 
 #define PMM_PAGE_TYPE_NORMAL 0
 #define PMM_PAGE_TYPE_SLAB 1
 #define PMM_PAGE_TYPE_KMALLOC 2
+#define PMM_PAGE_TYPE_FREE 3 //head of a free buddy block
+#define PMM_PAGE_TYPE_ANON 4 //private user page, private is its user address
 
 
 #define pmm_get_pages(page, size) (++(page->count))
@@ -33,7 +57,7 @@
     pmm_free_pages(page, size);
 
 
-#define pmm_alloc_one() pmm_alloc_pages(1, 0)
+#define pmm_alloc_one() pmm_alloc_pages(1, 0, 0)
 #define pmm_free_one(page) pmm_free_pages(page, 1)
 #define pmm_get_one(page) pmm_get_pages(page, 1)
 #define pmm_put_one(page) pmm_put_pages(page, 1)
@@ -50,20 +74,48 @@ struct page
     {
       struct list_head free_list;
       struct kcache * parent;
+      unsigned long inuse; //count of alloced objects in this slab
+      unsigned long objs_start; //address of the first object
+      unsigned short * free_index; //free object index stack of off-slab kcache
     }slab_frame;
 
     struct kmalloc_info
     {
       unsigned long size;
     }kmalloc_info;
+
+    struct buddy_info
+    {
+      unsigned long order;
+    }buddy_info;
   }use_for;
 };
 
+//a range of usable physical memory, [start, end)
+struct pmm_range
+{
+  unsigned long start;
+  unsigned long end;
+};
+
+struct pmm_shrinker
+{
+  int priority;
+  unsigned long (*shrink)(unsigned long nr_pages); //return the count of freed pages
+  struct list_head list;
+};
+
 void pmm_init();
-struct page* pmm_alloc_pages(unsigned long size, unsigned long align);
+struct page* pmm_alloc_pages(unsigned long size, unsigned long align, unsigned long flag);
 void pmm_free_pages(struct page * pages, unsigned long size);
 unsigned long pmm_page_to_paddr(struct page *);
 struct page * pmm_paddr_to_page(unsigned long address);
 void pmm_show_usable();
+unsigned long pmm_total_pages();
+int pmm_low_memory();
+void pmm_shrinker_init(struct pmm_shrinker * shrinker);
+void pmm_shrinker_regist(struct pmm_shrinker * shrinker);
+void pmm_shrinker_unregist(struct pmm_shrinker * shrinker);
+unsigned long pmm_reclaim(unsigned long nr_pages);
 
 #endif /* __YATOS_PMM_H */
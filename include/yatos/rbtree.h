@@ -0,0 +1,51 @@
+/*
+ *  Red-black tree
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/4 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __YATOS_RBTREE_H
+#define __YATOS_RBTREE_H
+
+#include <arch/system.h>
+#include <yatos/tools.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+#define rb_init_root(root) ((root)->node = NULL)
+
+struct rb_node
+{
+  struct rb_node * parent;
+  struct rb_node * left;
+  struct rb_node * right;
+  unsigned long color;
+};
+
+struct rb_root
+{
+  struct rb_node * node;
+};
+
+/*
+ * Recompute the augmented data of "node" from itself and its children.
+ * It's allowed to be NULL if the tree is not augmented.
+ */
+typedef void (*rb_augment_fun)(struct rb_node * node);
+
+void rb_insert(struct rb_root * root, struct rb_node * node, struct rb_node * parent,
+               struct rb_node ** link, rb_augment_fun augment);
+void rb_erase(struct rb_root * root, struct rb_node * node, rb_augment_fun augment);
+void rb_augment_path(struct rb_node * node, rb_augment_fun augment);
+
+#endif /* __YATOS_RBTREE_H */
@@ -24,6 +24,7 @@
 #define TASK_STATE_ZOMBIE 3
 
 void task_schedule();
+void task_yield();
 void task_schedule_init();
 void task_add_new_task(struct task *new);
 void task_delete_task(struct task * task);
@@ -33,5 +34,6 @@ void task_block(struct task * task);
 struct task*  task_get_cur();
 void task_check_schedule();
 struct task * task_find_by_pid(int pid);
+struct task * task_oom_select();
 
 #endif /* __YATOS_SCHEDILE_H */
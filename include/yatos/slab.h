@@ -20,28 +20,64 @@
 #include <yatos/list.h>
 
 #define page_to_slab(page) (&(page->use_for.slab_frame))
-#define objs_per_page(kcache) (PAGE_SIZE / kcache->obj_size)
+#define slab_size(kcache) (PAGE_SIZE << kcache->order)
+#define objs_per_slab(kcache) (slab_size(kcache) / kcache->obj_size)
+#define colour_step(kcache) (kcache->align > CACHE_LINE_SIZE ? kcache->align : CACHE_LINE_SIZE)
+//max count of empty slabs cached by one kcache
+#define SLAB_MAX_EMPTY_PAGES 2
+//a slab has at most 1 << SLAB_MAX_ORDER pages
+#define SLAB_MAX_ORDER 3
+//unused bytes of a slab should be less than 1 / SLAB_WASTE_DIV of slab
+#define SLAB_WASTE_DIV 8
+//objects not less than this size keep their free list out of slab
+#define SLAB_OFF_SLAB_SIZE (PAGE_SIZE / 8)
+//max count of objects in magazine
+#define SLAB_MAGAZINE_SIZE 16
+
+//flags of kcache
+//objects are constructed when slab is populated and destructed when slab is
+//released, they must be given back in constructed state.
+#define SLAB_CONSTRUCTED 1
 
 typedef void (*cache_constr_fun)(void *);
 typedef void (*cache_distr_fun)(void *);
 
+//recently freed objects that can be alloced again without touching slabs
+struct slab_magazine
+{
+  unsigned long count;
+  unsigned long limit;
+  void * objs[SLAB_MAGAZINE_SIZE];
+};
+
 struct kcache
 {
   unsigned long obj_size;
+  unsigned long align;
+  unsigned long order; //log2 of pages of one slab
+  unsigned long off_slab;
+  unsigned long flags;
+  unsigned long colour_num; //count of different offsets of the first object in page
+  unsigned long colour_next;
   struct list_head full_cache;
   struct list_head part_cache;
+  struct list_head empty_cache;
+  unsigned long empty_count;
+  struct slab_magazine magazine; //should be one for each cpu if we support SMP
   struct list_head kc_list_entry;
   cache_constr_fun constr;
   cache_distr_fun distr;
   char name[32];
 };
 
-struct kcache * slab_create_cache(unsigned long size,
-                                    cache_constr_fun constr,
+struct kcache * slab_create_cache(unsigned long size, unsigned long align, unsigned long flags,
+                                  cache_constr_fun constr,
                                   cache_distr_fun distr, const char * name);
 void slab_destory_cache(struct kcache * cache);
 void *slab_alloc_obj(struct kcache * cache);
 void slab_free_obj(void * obj);
+unsigned long slab_shrink(struct kcache * cache);
+void slab_flush_magazine(struct kcache * cache);
 void slab_init();
 void slab_show_all_kcache();
 
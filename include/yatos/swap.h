@@ -0,0 +1,54 @@
+/*
+ *  Swap of anonymous user pages.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/24 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __YATOS_SWAP_H
+#define __YATOS_SWAP_H
+
+#include <arch/system.h>
+#include <yatos/task_vmm.h>
+
+#define SWAP_PART_TYPE 0x82 //same as linux swap partition
+#define SWAP_SECTORS_PER_PAGE (PAGE_SIZE / 512)
+#define SWAP_DEVICE_MAX 2
+//slot in a pet entry is 20 bits, the high bit is the index of device
+#define SWAP_DEVICE_SHIFT (32 - PAGE_SHIFT - 1)
+#define SWAP_MAX_SLOTS (1UL << SWAP_DEVICE_SHIFT)
+#define SWAP_RMAP_MAX 16 //max number of pet entries of a page we can swap out
+#define SWAP_SCAN_MAX 4096 //max number of pages scanned by one shrink
+
+//a place to store swapped pages, devices are tried in the order of regist
+struct swap_device
+{
+  unsigned long slots;
+  //number of pet entries that hold each slot, never more than number of tasks
+  unsigned short * counts;
+  unsigned long cursor; //next slot to try
+  //store "page" in "slot", return 0 if successful or return 1 if we can not
+  int (*write)(struct swap_device * dev, unsigned long slot, void * page);
+  //return 0 if successful or return -1 if any error
+  int (*read)(struct swap_device * dev, unsigned long slot, void * page);
+  //called when nobody hold "slot" any more, may be NULL
+  void (*release)(struct swap_device * dev, unsigned long slot);
+  void * private;
+};
+
+void swap_init();
+int swap_regist_device(struct swap_device * dev);
+int swap_read(uint32 pet_e, void * page);
+void swap_dup(uint32 pet_e);
+void swap_free(uint32 pet_e);
+void swap_forget_vmm_info(struct task_vmm_info * mm_info);
+void zram_init();
+
+#endif /* __YATOS_SWAP_H */
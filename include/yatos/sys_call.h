@@ -25,6 +25,8 @@
 #define SYS_CALL_BRK 6
 #define SYS_CALL_GETPID 7
 #define SYS_CALL_CHDIR 8
+#define SYS_CALL_VFORK 9
+#define SYS_CALL_SPAWN 50
 
 //file operation
 #define SYS_CALL_OPEN 10
@@ -48,6 +50,12 @@
 //timer
 #define SYS_CALL_USLEEP 30
 
+//memory
+#define SYS_CALL_MMAP 35
+#define SYS_CALL_MUNMAP 36
+#define SYS_CALL_MPROTECT 37
+#define SYS_CALL_MADVISE 38
+
 //ipc
 #define SYS_CALL_PIPE 40
 #define SYS_CALL_SIGNAL 41
@@ -30,6 +30,9 @@
 #define SECTION_ALLOC 2
 #define SECTION_EXEC 4
 #define SECTION_NOBITS 8
+#define SECTION_SHARED 16 //pages are shared with other mappings, never copy on write
+#define SECTION_MMAP 32 //area is created by mmap
+#define SECTION_LARGE 64 //4MB aligned part of area is mapped by large page if possible
 
 #define MAX_OPEN_FD 64
 #define MAX_PID_NUM 256
@@ -40,6 +43,11 @@
 #define TASK_USER_STACK_LEN   0x40000000
 #define TASK_USER_HEAP_START (0xc0000000 - 0x80000000)
 #define TASK_USER_HEAP_DEAULT_LEN 0
+#define TASK_USER_MMAP_END (TASK_USER_STACK_START - TASK_USER_STACK_LEN)
+
+#define SPAWN_MAX_ACTIONS 16
+#define SPAWN_ACTION_CLOSE 1
+#define SPAWN_ACTION_DUP2 2
 
 #define task_get_bin(bin) (bin->count++)
 #define task_put_bin(bin)  \
@@ -71,6 +79,20 @@ struct exec_bin
   struct list_head section_list;
 };
 
+//fd actions of spawn, done in order in the new task
+struct spawn_action
+{
+  int type;
+  int fd;
+  int new_fd;
+};
+
+struct spawn_actions
+{
+  int count;
+  struct spawn_action actions[SPAWN_MAX_ACTIONS];
+};
+
 struct task_wait_entry
 {
   struct task * task;
@@ -102,6 +124,7 @@ struct task
   struct list_head zombie_childs;
   struct list_head child_list_entry;
   int waitpid_blocked; //block in waitpid ?
+  struct task * vfork_parent; //parent blocked in vfork until we exec or exit
 
   //schedule
   unsigned long remain_click;
@@ -139,6 +162,7 @@ void task_notify_all(struct task_wait_queue * queue);
 void task_leave_all_wq(struct task * task);
 void task_leave_from_wq(struct task_wait_entry * wait_entry);
 void task_segment_fault(struct task * task);
+int task_oom_kill();
 void task_exit(int status);
 void task_gener_wake_up(struct task * task, void * private);
 
@@ -17,6 +17,7 @@
 
 #include <arch/system.h>
 #include <yatos/list.h>
+#include <yatos/rbtree.h>
 #include <yatos/mm.h>
 #include <arch/mmu.h>
 
@@ -25,9 +26,13 @@
   do{\
     vmm_info->count--;\
     if(!vmm_info->count)\
-      slab_free_obj(vmm_info);\
+      task_free_vmm_info(vmm_info);\
   }while (0)
 
+//number of pages mapped around a no-page fault, must be power of 2
+#define TASK_VMM_FAULT_AROUND_DEFAULT 16
+#define TASK_VMM_FAULT_AROUND_MAX 64
+
 #define task_free_area(area) slab_free_obj(area)
 #define task_vmm_switch_to(pre, next) \
   mmu_set_page_table(vaddr_to_paddr(next->mm_table_vaddr))
@@ -39,8 +44,15 @@ struct task_vmm_area
   unsigned long flag; //write ? executeable ?
   void *private;
   struct list_head list_entry;
+  struct rb_node rb_node; //area_tree is sorted by start_addr
+  unsigned long max_end; //the max end address of areas in subtree of rb_node
   struct task_vmm_info * mm_info;
   void (*do_no_page)(struct task_vmm_area * area, unsigned long addr, char * new_page);
+  //can do_no_page fill page of addr without reading disk? used by fault-around
+  int (*page_ready)(struct task_vmm_area * area, unsigned long addr);
+  //get a cached page which can be mapped at addr by all tasks, NULL if not possible
+  char * (*share_page)(struct task_vmm_area * area, unsigned long addr);
+  void (*open)(struct task_vmm_area *area); //called when area is copied
   void (*close)(struct task_vmm_area *area);
 };
 
@@ -48,24 +60,44 @@ struct task_vmm_info
 {
   unsigned long count;
   unsigned long mm_table_vaddr;
+  unsigned long rss; //number of user pages mapped, used to select oom victim
   struct task_vmm_area * stack;
   struct task_vmm_area * heap;
   struct list_head vmm_area_list;
+  struct rb_root area_tree;
+  struct list_head list_entry; //in task_vmm_info_list
 };
 
+//all task_vmm_infos in use, swap searchs it for all mappings of a page
+extern struct list_head task_vmm_info_list;
+
 void task_vmm_init();
 struct task_vmm_info  * task_new_vmm_info();
+struct task_vmm_info * task_vmm_create_info();
+int task_vmm_install_page(struct task_vmm_info * mm_info, unsigned long addr, void * page);
 //just get a task_vmm_area
 struct task_vmm_area * task_new_pure_area();
 //alloc a area from vmm space
-struct task_vmm_area * task_alloc_area(struct task_vmm_info * mm_info, int len);
+struct task_vmm_area * task_alloc_area(struct task_vmm_info * mm_info, unsigned long len,
+                                       unsigned long align);
 int task_insert_area(struct task_vmm_info * vmm_info, struct task_vmm_area * area);
 struct task_vmm_area * task_vmm_search_area(struct task_vmm_info * mm_info, unsigned long start_addr);
+struct task_vmm_area * task_vmm_find_area(struct task_vmm_info * mm_info, unsigned long start_addr,
+                                          unsigned long end_addr);
+void task_remove_area(struct task_vmm_info * vmm_info, struct task_vmm_area * area);
+void task_resize_area(struct task_vmm_area * area, unsigned long len);
+int task_vmm_unmap_range(struct task_vmm_info * mm_info, unsigned long start_addr,
+                         unsigned long end_addr);
+void task_vmm_protect_range(struct task_vmm_info * mm_info, unsigned long start_addr,
+                            unsigned long end_addr);
 struct task_vmm_info * task_vmm_clone_info(struct task_vmm_info * from);
+void task_free_vmm_info(struct task_vmm_info * vmm);
 int task_copy_from_user(void * des, const void * src, unsigned long count);
 int task_copy_to_user(void * des, const void * src, unsigned long count);
 int task_copy_str_from_user(void * des, const char * str, unsigned long max_len);
 int task_copy_pts_from_user(void * des, const char ** p, unsigned long max_len);
 void task_vmm_clear(struct task_vmm_info *mm_info);
+void task_vmm_set_fault_around(unsigned long pages);
+uint32 * task_vmm_get_pet(struct task_vmm_info * mm_info, unsigned long addr);
 
 #endif /* __YATOS_TASK_VMM_H */
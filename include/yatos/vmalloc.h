@@ -0,0 +1,35 @@
+/*
+ *  Virtually contiguous kernel memory.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/2 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#ifndef __YATOS_VMALLOC_H
+#define __YATOS_VMALLOC_H
+
+#include <arch/system.h>
+#include <yatos/list.h>
+
+#define is_vmalloc_addr(addr) \
+  ((unsigned long)(addr) >= VMALLOC_START && (unsigned long)(addr) < VMALLOC_END)
+
+struct vmalloc_area
+{
+  unsigned long start_addr;
+  unsigned long pages;
+  struct list_head list_entry;
+};
+
+void vmalloc_init();
+void * vmalloc(unsigned long size);
+void vfree(void * addr);
+
+#endif /* __YATOS_VMALLOC_H */
@@ -279,13 +279,13 @@ static void ext2_init_group()
  */
 static void ext2_init_caches()
 {
-  inode_cache = slab_create_cache(sizeof(struct ext2_inode), NULL, NULL, "inode cache");
+  inode_cache = slab_create_cache(sizeof(struct ext2_inode), 0, 0, NULL, NULL, "inode cache");
   assert(inode_cache);
 
-  block_cache = slab_create_cache(block_size, NULL, NULL,"block cache");
+  block_cache = slab_create_cache(block_size, 0, 0, NULL, NULL,"block cache");
   assert(block_cache);
 
-  dir_entry_cache = slab_create_cache(sizeof(struct ext2_dir_entry) , NULL ,NULL, "dir entry cache");
+  dir_entry_cache = slab_create_cache(sizeof(struct ext2_dir_entry), 0, 0, NULL ,NULL, "dir entry cache");
   assert(dir_entry_cache);
 }
 
@@ -324,6 +324,10 @@ void ext2_sync_data(struct fs_inode* inode)
     block_offset = cur_buffer->block_offset * (FS_DATA_BUFFER_SIZE / block_size);
     for (i = 0; i < FS_DATA_BUFFER_SIZE / block_size && block_offset * block_size < file_size; i++, block_offset++)
       write_block(cur_buffer->block_num[i], cur_buffer->buffer + i * block_size);
+    //a mapped page of shared mapping may be written again without any fault,
+    //so it stays dirty until it is unmapped
+    if (BUFFER_IS_SHARED(cur_buffer) && vaddr_to_page((unsigned long)cur_buffer->buffer)->count > 1)
+      continue;
     BUFFER_CLER_DIRTY(cur_buffer);
   }
 
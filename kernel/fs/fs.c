@@ -16,6 +16,7 @@
 #include <yatos/ext2.h>
 #include <yatos/fs.h>
 #include <yatos/mm.h>
+#include <yatos/vmalloc.h>
 #include <yatos/ext2.h>
 #include <yatos/task.h>
 #include <yatos/sys_call.h>
@@ -29,10 +30,13 @@ static struct kcache * inode_cache;
 static struct kcache * data_buffer_cache;
 static struct list_head inode_list;
 static struct fs_file * root_dir;
+static struct pmm_shrinker data_buffer_shrinker;
+static struct pmm_shrinker inode_shrinker;
 
 /*
  * Constructor of fs_file.
- * This function will be called by slab_alloc_obj when we alloc a new fs_file struct.
+ * file_cache is a constructed cache, this function is called only when slab get
+ * a new page, and fs_free_file should give back fs_file in this state.
  */
 static void fs_constr_file(void *arg)
 {
@@ -41,15 +45,19 @@ static void fs_constr_file(void *arg)
 }
 
 /*
- * Destructor of fs_file.
- * This function will be called by slab_free_obj when we free a fs_file struct.
+ * Free a fs_file that nobody use any more.
+ * The file will be closed, and given back to file_cache in constructed state.
  */
-static void fs_distr_file(void *arg)
+void fs_free_file(struct fs_file * file)
 {
-  struct fs_file * file = (struct fs_file*)arg;
   if (file->inode && file->inode->action && file->inode->action->close)
     file->inode->action->close(file);
   fs_put_inode(file->inode);
+  file->inode = NULL;
+  file->cur_offset = 0;
+  file->flag = 0;
+  file->count = 1;
+  slab_free_obj(file);
 }
 
 /*
@@ -88,13 +96,40 @@ static void fs_distr_inode(void * arg)
 /*
  * Destructor of fs_data_buffer.
  * This function will be called by slab_free_obj when we free a fs_data_buffer struct.
+ * The page of buffer may be mapped by user tasks, so we only drop our reference,
+ * and the last user will free it.
  */
 static void fs_distr_dbuffer(void *arg)
 {
   struct fs_data_buffer * buffer = (struct fs_data_buffer *)arg;
+  struct page * page;
 
-  if (buffer->buffer)
-    mm_kfree(buffer->buffer);
+  if (buffer->buffer){
+    page = vaddr_to_page((unsigned long)buffer->buffer);
+    pmm_put_one(page);
+  }
+}
+
+/*
+ * Give "buf" a private page if its page is also mapped by user tasks,
+ * so that writing the file never changes the pages they mapped.
+ * Buffers mapped by shared mmap are always written in place.
+ * Return 0 if successful or return -ENOMEM if any error.
+ */
+static int fs_unshare_buffer(struct fs_data_buffer * buf)
+{
+  struct page * page = vaddr_to_page((unsigned long)buf->buffer);
+  char * buffer;
+
+  if (page->count == 1 || BUFFER_IS_SHARED(buf))
+    return 0;
+  buffer = mm_kmalloc(FS_DATA_BUFFER_SIZE);
+  if (!buffer)
+    return -ENOMEM;
+  memcpy(buffer, buf->buffer, FS_DATA_BUFFER_SIZE);
+  pmm_put_one(page);
+  buf->buffer = buffer;
+  return 0;
 }
 
 /*
@@ -103,13 +138,13 @@ static void fs_distr_dbuffer(void *arg)
  */
 static void fs_init_caches()
 {
-  file_cache = slab_create_cache(sizeof(struct fs_file), fs_constr_file , fs_distr_file, "fs_file cache");
+  file_cache = slab_create_cache(sizeof(struct fs_file), CACHE_LINE_SIZE, SLAB_CONSTRUCTED, fs_constr_file, NULL, "fs_file cache");
   assert(file_cache);
 
-  inode_cache = slab_create_cache(sizeof(struct fs_inode), fs_constr_inode, fs_distr_inode, "fs_inode cache");
+  inode_cache = slab_create_cache(sizeof(struct fs_inode), CACHE_LINE_SIZE, 0, fs_constr_inode, fs_distr_inode, "fs_inode cache");
   assert(inode_cache);
 
-  data_buffer_cache = slab_create_cache(sizeof(struct fs_data_buffer), NULL, fs_distr_dbuffer, "data_buffer cache");
+  data_buffer_cache = slab_create_cache(sizeof(struct fs_data_buffer), 0, 0, NULL, fs_distr_dbuffer, "data_buffer cache");
   assert(data_buffer_cache);
 }
 
@@ -142,6 +177,33 @@ static void fs_add_inode(struct fs_inode * inode)
   list_add_tail(&(inode->list_entry), &inode_list);
 }
 
+/*
+ * Find the data buffer of "block_offset" in the buffers of "fs_inode".
+ * Nothing will be read from disk.
+ * Return the buffer or return NULL if it is not cached.
+ */
+struct fs_data_buffer * fs_inode_find_buffer(struct fs_inode * fs_inode, unsigned long block_offset)
+{
+  struct list_head * cur;
+  struct fs_data_buffer * buf;
+
+  //check recent buffer;
+  if (fs_inode->recent_data && fs_inode->recent_data->block_offset == block_offset)
+    return fs_inode->recent_data;
+
+  //search
+  list_for_each(cur, &(fs_inode->data_buffers)){
+    buf = container_of(cur, struct fs_data_buffer, list_entry);
+    if (buf->block_offset == block_offset){
+      fs_inode->recent_data = buf;
+      return buf;
+    }
+    if (buf->block_offset > block_offset)
+      break;
+  }
+  return NULL;
+}
+
 /*
  * Get a buffer from inode buffers.
  * This function will create and fill a new buffer if nessary.
@@ -158,22 +220,12 @@ struct fs_data_buffer * fs_inode_get_buffer(struct fs_inode * fs_inode, unsigned
 
   if (!fs_inode)
     return NULL;
-  //check recent buffer;
-  if (fs_inode->recent_data && fs_inode->recent_data->block_offset == block_offset)
-    return fs_inode->recent_data;
-
-  //search
-  list_for_each(cur, &(fs_inode->data_buffers)){
-    after = container_of(cur, struct fs_data_buffer, list_entry);
-    if (after->block_offset == block_offset){
-      fs_inode->recent_data = after;
-      return after;
-    }
-    if (after->block_offset > block_offset)
-      break;
-  }
+  buf = fs_inode_find_buffer(fs_inode, block_offset);
+  if (buf)
+    return buf;
 
   //can not found, add new
+  //note: memory reclaim may free other buffers of this inode when we alloc
   buf = slab_alloc_obj(data_buffer_cache);
   if (!buf)
     return NULL;
@@ -185,10 +237,15 @@ struct fs_data_buffer * fs_inode_get_buffer(struct fs_inode * fs_inode, unsigned
   }
   buf->buffer = buffer;
   if (ext2_fill_buffer(fs_inode, buf)){
-      mm_kfree(buffer);
-      slab_free_obj(buf);
+      slab_free_obj(buf); //buffer is freed by fs_distr_dbuffer
       return NULL;
   }
+  //find the position again since list may be changed by reclaim
+  list_for_each(cur, &(fs_inode->data_buffers)){
+    after = container_of(cur, struct fs_data_buffer, list_entry);
+    if (after->block_offset > block_offset)
+      break;
+  }
   list_add(&(buf->list_entry), cur->prev);
   fs_inode->recent_data = buf;
   return buf;
@@ -258,6 +315,11 @@ static int fs_gener_write(struct fs_file* file,char* buffer,unsigned long count)
     block_offset = off_set / FS_DATA_BUFFER_SIZE;
     buff_offset = off_set % FS_DATA_BUFFER_SIZE;
     buf = fs_inode_get_buffer(inode, block_offset);
+    //stop at the position we really reach
+    if (!buf || fs_unshare_buffer(buf)){
+      file->cur_offset = off_set;
+      return write_count ? write_count : -ENOMEM;
+    }
     BUFFER_SET_DIRTY(buf);
     cpy_size = FS_DATA_BUFFER_SIZE - buff_offset;
     if (cpy_size > count)
@@ -450,9 +512,13 @@ struct fs_file * fs_open(const char * path, int flag, mode_t mode, int *ret)
     }
     cur_inode->parent = parent;
   }
+  //hold the inode now, inode with count 0 may be freed by reclaim in truncate
+  //or alloc of fs_file
+  fs_get_inode(cur_inode);
 
   //error of file exist
   if ((flag & O_CREAT) && (flag & O_EXCL) && !new_file){
+    fs_put_inode(cur_inode);
     *ret = -EEXIST;
     return NULL;
   }
@@ -463,14 +529,13 @@ struct fs_file * fs_open(const char * path, int flag, mode_t mode, int *ret)
   //ok we have got inode , now  we create fs_file for return
   ret_file = slab_alloc_obj(file_cache);
   if (!ret_file){
+    fs_put_inode(cur_inode);
     *ret = -ENOMEM;
     return NULL;
   }
   ret_file->inode = cur_inode;
   cur_inode->action = &gerner_inode_oper;
   ret_file->flag = flag;
-  //now we should incre file's inode count
-  fs_get_inode(cur_inode);
   *ret = 0;
   return ret_file;
 }
@@ -600,16 +665,15 @@ static int sys_call_read(struct pt_regs * regs)
   if (!size)
     return 0;
 
-  tmp_buffer = mm_kmalloc(size);
+  //big buffer don't need to be physically contiguous
+  tmp_buffer = size > PAGE_SIZE ? vmalloc(size) : mm_kmalloc(size);
   if (!tmp_buffer)
     return -ENOMEM;
 
   read_n = file->inode->action->read(file, tmp_buffer, size);
   if (read_n > 0){
-    if (task_copy_to_user(buffer, tmp_buffer, read_n)){
-      mm_kfree(tmp_buffer);
+    if (task_copy_to_user(buffer, tmp_buffer, read_n))
       read_n = -EFAULT;
-    }
   }
   mm_kfree(tmp_buffer);
   return read_n;
@@ -639,7 +703,11 @@ static int sys_call_write(struct pt_regs *regs)
   if (!file || !file->inode || !file->inode->action->write)
     return -EINVAL;
 
-  tmp_buffer = mm_kmalloc(size);
+  if (!size)
+    return 0;
+
+  //big buffer don't need to be physically contiguous
+  tmp_buffer = size > PAGE_SIZE ? vmalloc(size) : mm_kmalloc(size);
   if (!tmp_buffer)
     return -ENOMEM;
 
@@ -1008,6 +1076,72 @@ static int sys_call_dup3(struct pt_regs * regs)
   return 0;
 }
 
+/*
+ * Shrinker of data buffers.
+ * Free clean data buffers of all hashed inodes, they will be read again from disk
+ * when we need. Dirty buffers and the recent buffer of a inode are kept.
+ * Return the count of freed pages.
+ */
+static unsigned long fs_shrink_data_buffers(unsigned long nr_pages)
+{
+  struct list_head * cur, * cur_buf, * next;
+  struct fs_inode * inode;
+  struct fs_data_buffer * data;
+  unsigned long freed = 0;
+
+  list_for_each(cur, &inode_list){
+    inode = container_of(cur, struct fs_inode, list_entry);
+    list_for_each_safe(cur_buf, next, &(inode->data_buffers)){
+      data = container_of(cur_buf, struct fs_data_buffer, list_entry);
+      //buffer mapped by user tasks can not be freed
+      if (BUFFER_IS_DIRTY(data) || data == inode->recent_data ||
+          vaddr_to_page((unsigned long)data->buffer)->count > 1)
+        continue;
+      list_del(cur_buf);
+      slab_free_obj(data);
+      if (++freed >= nr_pages)
+        return freed;
+    }
+  }
+  return freed;
+}
+
+/*
+ * Shrinker of inode hash.
+ * Free the inodes that nobody opened, with all their data buffers.
+ * Dir inodes are kept since they may be the parent of other inodes.
+ * Return the count of freed pages.
+ */
+static unsigned long fs_shrink_inodes(unsigned long nr_pages)
+{
+  struct list_head * cur, * next, * cur_buf;
+  struct fs_inode * inode;
+  struct fs_data_buffer * data;
+  unsigned long freed = 0, buffers;
+  int dirty;
+
+  list_for_each_safe(cur, next, &inode_list){
+    inode = container_of(cur, struct fs_inode, list_entry);
+    if (inode->count || S_ISDIR(inode->mode))
+      continue;
+    dirty = 0;
+    buffers = 0;
+    list_for_each(cur_buf, &(inode->data_buffers)){
+      data = container_of(cur_buf, struct fs_data_buffer, list_entry);
+      dirty |= BUFFER_IS_DIRTY(data);
+      if (vaddr_to_page((unsigned long)data->buffer)->count == 1)
+        buffers++;
+    }
+    if (dirty)
+      continue;
+    slab_free_obj(inode);
+    freed += buffers;
+    if (freed >= nr_pages)
+      break;
+  }
+  return freed;
+}
+
 /*
  * Initate virtual file system.
  * System will go die if any error.
@@ -1043,6 +1177,16 @@ void fs_init()
   sys_call_regist(SYS_CALL_FSTAT, sys_call_fstat);
   sys_call_regist(SYS_CALL_DUP3, sys_call_dup3);
   sys_call_regist(SYS_CALL_FCNTL, sys_call_fcntl);
+
+  pmm_shrinker_init(&data_buffer_shrinker);
+  data_buffer_shrinker.priority = PMM_SHRINK_PRIO_CACHE;
+  data_buffer_shrinker.shrink = fs_shrink_data_buffers;
+  pmm_shrinker_regist(&data_buffer_shrinker);
+
+  pmm_shrinker_init(&inode_shrinker);
+  inode_shrinker.priority = PMM_SHRINK_PRIO_CACHE;
+  inode_shrinker.shrink = fs_shrink_inodes;
+  pmm_shrinker_regist(&inode_shrinker);
 }
 
 /*
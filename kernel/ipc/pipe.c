@@ -21,6 +21,7 @@
 #include <yatos/fs.h>
 #include <yatos/bitmap.h>
 #include <yatos/errno.h>
+#include <yatos/signal.h>
 
 /*
  * Read function of pipe inode.
@@ -74,6 +75,9 @@ static int pipe_read(struct fs_file * file, char * buffer, unsigned long count)
       task_wait_on(&entry, pipe_info->r_wait_queue);
       task_schedule();
       task_leave_from_wq(&entry);
+      //a killed task should not sleep here again
+      if (sig_is_pending(task))
+        return -EINTR;
     }
   }
   return 0;
@@ -133,6 +137,9 @@ static int pipe_write(struct fs_file * file, char *buffer, unsigned long count)
       task_wait_on(&entry, pipe_info->w_wait_queue);
       task_schedule();
       task_leave_from_wq(&entry);
+      //a killed task should not sleep here again
+      if (sig_is_pending(task))
+        return -EINTR;
     }
   }
   return 0;
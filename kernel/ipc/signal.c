@@ -160,7 +160,7 @@ static int sys_call_kill(struct pt_regs * regs)
  */
 void sig_init()
 {
-  sig_info_cache = slab_create_cache(sizeof(struct sig_info), NULL, NULL, "sig_info cache");
+  sig_info_cache = slab_create_cache(sizeof(struct sig_info), 0, 0, NULL, NULL, "sig_info cache");
   assert(sig_info_cache);
 
   sys_call_regist(SYS_CALL_SIGNAL, sys_call_signal);
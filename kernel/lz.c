@@ -0,0 +1,169 @@
+/*
+ *  LZ77 compressor
+ *  The format is the same as lz4 block: every sequence is a token, literals,
+ *  and a match of 16 bits offset. High 4 bits of token is the literal length,
+ *  low 4 bits is the match length minus LZ_MIN_MATCH, 15 means more bytes of
+ *  length follow, until a byte less than 255. The last sequence has literals only.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/26 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#include <yatos/lz.h>
+#include <yatos/tools.h>
+
+//position of the last 4 bytes with the same hash, shared by all callers since
+//kernel is never preempted
+static unsigned short lz_hash[1 << LZ_HASH_BITS];
+
+#define lz_read32(p) \
+  ((uint32)(p)[0] | ((uint32)(p)[1] << 8) | ((uint32)(p)[2] << 16) | ((uint32)(p)[3] << 24))
+
+#define lz_hash_of(v) \
+  (((v) * 2654435761U) >> (32 - LZ_HASH_BITS))
+
+/*
+ * Write the extra bytes of a length that is not less than 15.
+ */
+static unsigned char * lz_put_len(unsigned char * op, unsigned long len)
+{
+  for (len -= 15; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/*
+ * Write a sequence of "lit" literals and a match, "mlen" is 0 for the last one.
+ * Return 0 if successful or return 1 if there is no enough space.
+ */
+static int lz_put_seq(unsigned char ** op_p, unsigned char * oend, const unsigned char * lit_src,
+                      unsigned long lit, unsigned long offset, unsigned long mlen)
+{
+  unsigned char * op = *op_p;
+  unsigned long ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+  //the worst case, length bytes are counted more than needed
+  if ((unsigned long)(oend - op) < 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1)
+    return 1;
+  *op++ = ((lit >= 15 ? 15 : lit) << 4) | (ml >= 15 ? 15 : ml);
+  if (lit >= 15)
+    op = lz_put_len(op, lit);
+  memcpy(op, lit_src, lit);
+  op += lit;
+  if (mlen){
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if (ml >= 15)
+      op = lz_put_len(op, ml);
+  }
+  *op_p = op;
+  return 0;
+}
+
+/*
+ * Get the extra bytes of a length.
+ * Return 0 if successful or return 1 if input is broken.
+ */
+static int lz_get_len(const unsigned char ** ip_p, const unsigned char * iend, unsigned long * len)
+{
+  unsigned char c;
+
+  do{
+    if (*ip_p >= iend)
+      return 1;
+    c = *(*ip_p)++;
+    *len += c;
+  }while (c == 255);
+  return 0;
+}
+
+/*
+ * Compress "len" bytes of "src" to "dst", "len" should not be more than
+ * LZ_MAX_INPUT. Matches are found by a hash table of 4 bytes, so this is fast
+ * but does not compress as well as the best.
+ * Return the compressed length or return 0 if it is more than "max_len".
+ */
+unsigned long lz_compress(const unsigned char * src, unsigned long len,
+                          unsigned char * dst, unsigned long max_len)
+{
+  const unsigned char * ip = src, * anchor = src, * end = src + len;
+  const unsigned char * match;
+  unsigned char * op = dst, * oend = dst + max_len;
+  unsigned long mlen;
+  uint32 h;
+
+  if (len > LZ_MAX_INPUT)
+    return 0;
+  memset(lz_hash, 0, sizeof(lz_hash));
+  while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH){
+    h = lz_hash_of(lz_read32(ip));
+    match = src + lz_hash[h];
+    lz_hash[h] = ip - src;
+    if (match >= ip || lz_read32(match) != lz_read32(ip)){
+      ip++;
+      continue;
+    }
+    for (mlen = LZ_MIN_MATCH; ip + mlen < end && match[mlen] == ip[mlen]; mlen++);
+    if (lz_put_seq(&op, oend, anchor, ip - anchor, ip - match, mlen))
+      return 0;
+    ip += mlen;
+    anchor = ip;
+  }
+  if (lz_put_seq(&op, oend, anchor, end - anchor, 0, 0))
+    return 0;
+  return op - dst;
+}
+
+/*
+ * Decompress "len" bytes of "src" to "dst".
+ * Return the decompressed length or return -1 if input is broken or output is
+ * more than "max_len".
+ */
+long lz_decompress(const unsigned char * src, unsigned long len,
+                   unsigned char * dst, unsigned long max_len)
+{
+  const unsigned char * ip = src, * iend = src + len;
+  const unsigned char * match;
+  unsigned char * op = dst, * oend = dst + max_len;
+  unsigned long lit, mlen, offset;
+  unsigned char token;
+
+  while (ip < iend){
+    token = *ip++;
+    lit = token >> 4;
+    if (lit == 15 && lz_get_len(&ip, iend, &lit))
+      return -1;
+    if (lit > (unsigned long)(iend - ip) || lit > (unsigned long)(oend - op))
+      return -1;
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (!offset || offset > (unsigned long)(op - dst))
+      return -1;
+    mlen = token & 15;
+    if (mlen == 15 && lz_get_len(&ip, iend, &mlen))
+      return -1;
+    mlen += LZ_MIN_MATCH;
+    if (mlen > (unsigned long)(oend - op))
+      return -1;
+    //match may overlap the output, so copy byte by byte
+    for (match = op - offset; mlen; mlen--)
+      *op++ = *match++;
+  }
+  return op - dst;
+}
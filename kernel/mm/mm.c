@@ -16,24 +16,66 @@
 #include <yatos/pmm.h>
 #include <yatos/tools.h>
 #include <yatos/printk.h>
+#include <yatos/vmalloc.h>
 #include <arch/mmu.h>
+#include <arch/irq.h>
 
-static struct kcache * kmalloc_caches[MAX_KMALLOC_SLAB_LEVE];
+static struct kcache * kmalloc_caches[KMALLOC_CLASS_NUM];
+static const unsigned long kmalloc_sizes[KMALLOC_CLASS_NUM] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072
+};
+//index of kmalloc class for every KMALLOC_SIZE_GRAIN bytes
+static unsigned char kmalloc_size_class[KMALLOC_MAX_SIZE / KMALLOC_SIZE_GRAIN];
+static struct list_head zero_pool; //pages which are already filled with zero
+static unsigned long zero_pool_count;
+static struct pmm_shrinker zero_pool_shrinker;
 
 /*
- * Initate the kcaches of common size slab.
+ * Initate the kcaches of common size slab, and the table for finding kcache by size.
+ * Objects are aligned to the largest power of 2 that divides their size, so classes
+ * like 48 and 96 are not rounded up to a whole cache line.
  */
 static void kmalloc_init()
 {
-  int i;
+  int i, j = 0;
+  unsigned long size, align;
   char name[32];
-  for (i = MIN_KMALLOC_SLAB_LEVE; i < MAX_KMALLOC_SLAB_LEVE; ++i){
-    sprintf(name, "kmalloc cache %d", i);
-    kmalloc_caches[i] = slab_create_cache(1 << i, NULL, NULL, name);
+  for (i = 0; i < KMALLOC_CLASS_NUM; ++i){
+    size = kmalloc_sizes[i];
+    align = size & -size;
+    if (align > CACHE_LINE_SIZE)
+      align = CACHE_LINE_SIZE;
+    sprintf(name, "kmalloc cache %d", size);
+    kmalloc_caches[i] = slab_create_cache(size, align, 0, NULL, NULL, name);
     assert(kmalloc_caches[i]);
+    for (; j < size / KMALLOC_SIZE_GRAIN; j++)
+      kmalloc_size_class[j] = i;
   }
 }
 
+/*
+ * Shrinker of zero pool.
+ * Give back pages in zero pool to pmm, they will be filled again in idle time.
+ * Return the count of freed pages.
+ */
+static unsigned long mm_shrink_zero_pool(unsigned long nr_pages)
+{
+  struct page * page;
+  unsigned long freed = 0;
+  uint32 save = arch_irq_save();
+
+  arch_irq_disable();
+  while (zero_pool_count && freed < nr_pages){
+    page = container_of(zero_pool.next, struct page, page_list);
+    list_del(&(page->page_list));
+    zero_pool_count--;
+    pmm_free_one(page);
+    freed++;
+  }
+  arch_irq_recover(save);
+  return freed;
+}
+
 /*
  * Initate RAM manage module.
  */
@@ -43,6 +85,13 @@ void mm_init()
   pmm_init();
   slab_init();
   kmalloc_init();
+  INIT_LIST_HEAD(&zero_pool);
+  vmalloc_init();
+
+  pmm_shrinker_init(&zero_pool_shrinker);
+  zero_pool_shrinker.priority = PMM_SHRINK_PRIO_POOL;
+  zero_pool_shrinker.shrink = mm_shrink_zero_pool;
+  pmm_shrinker_regist(&zero_pool_shrinker);
 }
 
 /*
@@ -53,16 +102,14 @@ void mm_init()
 void * mm_kmalloc(unsigned long size)
 {
   struct page * ret_page;
-  int i;
   assert(size);
 
-  for (i = MIN_KMALLOC_SLAB_LEVE ; i < MAX_KMALLOC_SLAB_LEVE; ++i)
-    if (size <= (1 << i))
-      return (void *)slab_alloc_obj(kmalloc_caches[i]);
+  if (size <= KMALLOC_MAX_SIZE)
+    return slab_alloc_obj(kmalloc_caches[kmalloc_size_class[(size - 1) / KMALLOC_SIZE_GRAIN]]);
 
   //how many pages we need
   size = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-  ret_page = pmm_alloc_pages(size,0);
+  ret_page = pmm_alloc_pages(size, 0, 0);
   if (!ret_page)
     return NULL;
   ret_page->type = PMM_PAGE_TYPE_KMALLOC;
@@ -72,7 +119,7 @@ void * mm_kmalloc(unsigned long size)
 }
 
 /*
- * Free memory that we alloced before by mm_kmalloc.
+ * Free memory that we alloced before by mm_kmalloc or vmalloc.
  * we use slab_free_obj or pmm_free_pages according to the type of page struct,
  * it had been initiated when we use mm_kmalloc.
  */
@@ -80,6 +127,10 @@ void mm_kfree(void * addr)
 {
   if (!addr)
     return ;
+  if (is_vmalloc_addr(addr)){
+    vfree(addr);
+    return ;
+  }
 
   struct page * page = vaddr_to_page((unsigned long)addr);
   assert(page->type == PMM_PAGE_TYPE_KMALLOC || page->type == PMM_PAGE_TYPE_SLAB);
@@ -89,3 +140,92 @@ void mm_kfree(void * addr)
   else
     pmm_free_pages(page, page->use_for.kmalloc_info.size);
 }
+
+/*
+ * Take a page from zero pool.
+ * Return address of the page or return NULL if pool is empty.
+ */
+static void * mm_take_zero_page()
+{
+  struct page * page = NULL;
+  uint32 save = arch_irq_save();
+
+  arch_irq_disable();
+  if (zero_pool_count){
+    page = container_of(zero_pool.next, struct page, page_list);
+    list_del(&(page->page_list));
+    zero_pool_count--;
+  }
+  arch_irq_recover(save);
+  return page ? (void *)paddr_to_vaddr(pmm_page_to_paddr(page)) : NULL;
+}
+
+/*
+ * Alloc a page filled with zero.
+ * The page is taken from zero pool if possible, so we don't need to clear it here.
+ * Return address of the page if successful or return NULL if no memory.
+ *
+ * Note: the page should be freed by mm_kfree.
+ */
+void * mm_alloc_zero_page()
+{
+  void * ret = mm_take_zero_page();
+
+  if (ret)
+    return ret;
+  ret = mm_kmalloc(PAGE_SIZE);
+  if (ret)
+    memset(ret, 0, PAGE_SIZE);
+  return ret;
+}
+
+/*
+ * Same as mm_alloc_zero_page, but never reclaim memory, for optional pages.
+ * Return address of the page if successful or return NULL if no free memory.
+ *
+ * Note: the page should be freed by mm_kfree.
+ */
+void * mm_alloc_zero_page_noreclaim()
+{
+  void * ret = mm_take_zero_page();
+  struct page * page;
+
+  if (ret)
+    return ret;
+  page = pmm_alloc_pages(1, 0, PMM_ALLOC_NORECLAIM);
+  if (!page)
+    return NULL;
+  page->type = PMM_PAGE_TYPE_KMALLOC;
+  page->use_for.kmalloc_info.size = 1;
+  ret = (void *)paddr_to_vaddr(pmm_page_to_paddr(page));
+  memset(ret, 0, PAGE_SIZE);
+  return ret;
+}
+
+/*
+ * Fill one more page into zero pool.
+ * This function is called by task_schedule when there is no task to run.
+ * Return 1 if a page was added or return 0 if pool is full or memory is low.
+ */
+int mm_fill_zero_pool()
+{
+  struct page * page;
+  uint32 save;
+
+  //the pool is optional, never make others reclaim for it
+  if (zero_pool_count >= MM_ZERO_POOL_MAX || pmm_low_memory())
+    return 0;
+  page = pmm_alloc_pages(1, 0, PMM_ALLOC_NORECLAIM);
+  if (!page)
+    return 0;
+  page->type = PMM_PAGE_TYPE_KMALLOC;
+  page->use_for.kmalloc_info.size = 1;
+  memset((void *)paddr_to_vaddr(pmm_page_to_paddr(page)), 0, PAGE_SIZE);
+
+  save = arch_irq_save();
+  arch_irq_disable();
+  list_add(&(page->page_list), &zero_pool);
+  zero_pool_count++;
+  arch_irq_recover(save);
+  return 1;
+}
@@ -17,11 +17,41 @@
 #include <yatos/printk.h>
 #include <yatos/tools.h>
 #include <yatos/list.h>
+#include <arch/asm.h>
+#include <arch/e820.h>
 
-static struct page pmm_pages[FREE_PAGE_TOTAL];
+static struct page * pmm_sections[PMM_SECTION_NUM]; //memmap of each section, NULL for a hole
+static struct page * pmm_memmap; //all memmaps of sections, one after another
+static unsigned long pmm_memmap_sections[PMM_SECTION_NUM]; //section number of each memmap
 static struct list_head pmm_free_page_lists[PMM_MAX_LEVE];
 static unsigned long pmm_free_lists_count[PMM_MAX_LEVE];
-static unsigned long pmm_useable_page = FREE_PAGE_TOTAL;
+static unsigned long pmm_free_orders; //bit n is set if free list n is not empty
+static unsigned long pmm_total_page;
+static unsigned long pmm_useable_page;
+static unsigned long pmm_low_watermark;
+static unsigned long pmm_high_watermark;
+static struct list_head pmm_shrinker_list; //sorted by priority
+//usable memory from E820 map, sorted and never overlap
+static struct pmm_range pmm_ranges[PMM_RANGE_MAX];
+static int pmm_range_num;
+static int pmm_reclaiming;
+
+/*
+ * Get the number of pages of all RAM.
+ */
+unsigned long pmm_total_pages()
+{
+  return pmm_total_page;
+}
+
+/*
+ * Check if free pages are below the low watermark, optional memory should not
+ * be taken then.
+ */
+int pmm_low_memory()
+{
+  return pmm_useable_page < pmm_low_watermark;
+}
 
 /*
  * Show memory utilization
@@ -29,8 +59,9 @@ static unsigned long pmm_useable_page = FREE_PAGE_TOTAL;
 void pmm_show_useable()
 {
   int i;
-  printk("total memory : %dMB and %dKB\n\r", PHY_MM_SIZE / 1024 / 1024,
-         (PHY_MM_SIZE / 1024) % 1024);
+  printk("total memory : %dMB and %dKB\n\r",
+         (pmm_total_page * 4) / 1024,
+         (pmm_total_page * 4) % 1024);
   printk("free useable memory : %dMB and %dKB\n\r",
          (pmm_useable_page * 4) / 1024 ,
          (pmm_useable_page * 4) % 1024);
@@ -41,166 +72,414 @@ void pmm_show_useable()
 }
 
 /*
- * Insert pages to "list".
- * We need to keep "list" in no-descending order.
+ * Page frame number helpers.
+ * Buddies are paired by physical frame number, so every block of order n
+ * is also aligned to (1 << n) pages in physical memory.
+ * Return NULL if "pfn" is in a section without memmap.
  */
-static void pmm_insert_to(struct list_head *list, struct page * page)
+static unsigned long pmm_page_to_pfn(struct page * page)
+{
+  unsigned long index = page - pmm_memmap;
+  return (pmm_memmap_sections[index >> PMM_SECTION_ORDER] << PMM_SECTION_ORDER)
+    + (index & (PMM_SECTION_PAGES - 1));
+}
+
+static struct page * pmm_pfn_to_page(unsigned long pfn)
 {
-  struct page * cur_page = NULL;
-  struct list_head * pos = NULL;
-  unsigned long size = 1 << (list - pmm_free_page_lists);
-  int overlap;
+  struct page * map;
 
-  list_for_each(pos, list){
-    cur_page = container_of(pos, struct page, page_list);
+  if ((pfn >> PMM_SECTION_ORDER) >= PMM_SECTION_NUM)
+    return NULL;
+  map = pmm_sections[pfn >> PMM_SECTION_ORDER];
+  if (!map)
+    return NULL;
+  return map + (pfn & (PMM_SECTION_PAGES - 1));
+}
 
-    overlap = (cur_page <= page && cur_page + size > page) ||
-      (cur_page >= page && page + size > cur_page);
-    assert(!overlap);
+/*
+ * Link a free block of (1 << "order") pages to the free list of "order".
+ * Only the first page of a free block is marked as PMM_PAGE_TYPE_FREE.
+ */
+static void pmm_add_block(struct page * page, unsigned long order)
+{
+  page->type = PMM_PAGE_TYPE_FREE;
+  page->use_for.buddy_info.order = order;
+  list_add(&(page->page_list), pmm_free_page_lists + order);
+  pmm_free_lists_count[order]++;
+  pmm_free_orders |= 1UL << order;
+}
 
-    if (cur_page > page){
-      list_add_tail(&(page->page_list), &(cur_page->page_list));
-     return ;
-    }
+/*
+ * Unlink a free block from the free list of "order".
+ */
+static void pmm_del_block(struct page * page, unsigned long order)
+{
+  list_del(&(page->page_list));
+  if (!--pmm_free_lists_count[order])
+    pmm_free_orders &= ~(1UL << order);
+  page->type = PMM_PAGE_TYPE_NORMAL;
+}
+
+/*
+ * Give back a block of (1 << "order") pages.
+ * The block will be merged with it's buddy as long as the buddy is free and has the
+ * same order, so this costs at most PMM_MAX_LEVE steps.
+ */
+static void pmm_free_block(struct page * page, unsigned long order)
+{
+  unsigned long pfn = pmm_page_to_pfn(page);
+  struct page * buddy;
+
+  while (order < PMM_MAX_LEVE - 1){
+    buddy = pmm_pfn_to_page(pfn ^ (1UL << order));
+    if (!buddy || buddy->type != PMM_PAGE_TYPE_FREE
+        || buddy->use_for.buddy_info.order != order)
+      break;
+    pmm_del_block(buddy, order);
+    pfn &= ~(1UL << order);
+    order++;
   }
-  list_add_tail(&(page->page_list), list);
-  pmm_free_lists_count[list - pmm_free_page_lists]++;
+  pmm_add_block(pmm_pfn_to_page(pfn), order);
 }
 
 /*
- * Putback pages to free lists.
- * Pages may be split and insert to different list.
+ * Give back "size" pages start at "pfn".
+ * The range will be split into the biggest aligned blocks.
  */
-static void pmm_putback_remain(struct page* remain, unsigned long size)
+static void pmm_free_range(unsigned long pfn, unsigned long size)
 {
-  struct page * temp = NULL;
-  int pow = 0;
+  unsigned long order;
+
+  while (size){
+    //limited by both the alignment of "pfn" and "size"
+    order = arch_bsr(size);
+    if (pfn && arch_bsf(pfn) < order)
+      order = arch_bsf(pfn);
+    if (order > PMM_MAX_LEVE - 1)
+      order = PMM_MAX_LEVE - 1;
+    pmm_free_block(pmm_pfn_to_page(pfn), order);
+    pfn += 1UL << order;
+    size -= 1UL << order;
+  }
+}
+
+/*
+ * Get the physical range of a E820 entry, limited in the memory that kernel can use.
+ * Usable range is shrunk to whole pages, and other range is grown to whole pages.
+ * Return 0 and fill [*start, *end) or return 1 if the range is empty.
+ */
+static int pmm_entry_range(struct e820_entry * entry, unsigned long * start, unsigned long * end)
+{
+  unsigned long limit = PHY_MM_START + PHY_MM_SIZE;
+
+  if (entry->base_high)
+    return 1;
+  *start = entry->base_low;
+  *end = entry->base_low + entry->len_low;
+  if (entry->len_high || *end < *start || *end > limit)
+    *end = limit;
+
+  if (entry->type == E820_TYPE_RAM){
+    *start = (*start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    *end = PAGE_ALIGN(*end);
+  }else{
+    *start = PAGE_ALIGN(*start);
+    *end = (*end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  }
+  if (*start < FREE_PMM_START)
+    *start = FREE_PMM_START;
+  return *start >= *end;
+}
 
-  if (size == 0)
+/*
+ * Add [start, end) to usable ranges, it is merged with ranges it overlaps or touchs.
+ */
+static void pmm_add_range(unsigned long start, unsigned long end)
+{
+  int i, j;
+
+  for (i = 0; i < pmm_range_num && pmm_ranges[i].end < start; i++);
+  if (i < pmm_range_num && pmm_ranges[i].start <= end){
+    if (start < pmm_ranges[i].start)
+      pmm_ranges[i].start = start;
+    if (end > pmm_ranges[i].end)
+      pmm_ranges[i].end = end;
+    //the range may grow over the ranges after it
+    while (i + 1 < pmm_range_num && pmm_ranges[i + 1].start <= pmm_ranges[i].end){
+      if (pmm_ranges[i + 1].end > pmm_ranges[i].end)
+        pmm_ranges[i].end = pmm_ranges[i + 1].end;
+      for (j = i + 1; j < pmm_range_num - 1; j++)
+        pmm_ranges[j] = pmm_ranges[j + 1];
+      pmm_range_num--;
+    }
+    return ;
+  }
+  if (pmm_range_num == PMM_RANGE_MAX)
     return ;
-  temp = remain;
-  for (pow = 0; pow < PMM_MAX_LEVE; ++pow){
-    if (((size >> pow) & 1)){
-      pmm_insert_to(pmm_free_page_lists + pow, temp);
-      temp += 1 << pow;
+  for (j = pmm_range_num; j > i; j--)
+    pmm_ranges[j] = pmm_ranges[j - 1];
+  pmm_ranges[i].start = start;
+  pmm_ranges[i].end = end;
+  pmm_range_num++;
+}
+
+/*
+ * Remove [start, end) from usable ranges, a range may be split into two.
+ */
+static void pmm_remove_range(unsigned long start, unsigned long end)
+{
+  struct pmm_range * range;
+  int i, j;
+
+  for (i = 0; i < pmm_range_num; i++){
+    range = pmm_ranges + i;
+    if (range->end <= start || range->start >= end)
+      continue;
+    if (range->start < start && range->end > end){
+      //the tail is given up if there is no space, we lose memory but never use
+      //reserved one
+      if (pmm_range_num < PMM_RANGE_MAX){
+        for (j = pmm_range_num; j > i + 1; j--)
+          pmm_ranges[j] = pmm_ranges[j - 1];
+        pmm_ranges[i + 1].start = end;
+        pmm_ranges[i + 1].end = range->end;
+        pmm_range_num++;
+        i++;
+      }
+      range->end = start;
+    }else if (range->start < start)
+      range->end = start;
+    else if (range->end > end)
+      range->start = end;
+    else{
+      for (j = i; j < pmm_range_num - 1; j++)
+        pmm_ranges[j] = pmm_ranges[j + 1];
+      pmm_range_num--;
+      i--;
     }
   }
 }
 
+/*
+ * Build usable ranges from E820 map.
+ * BIOS may give overlapping entries, so usable entries are merged first, then
+ * all other entries are removed from them, a page is never usable if any entry
+ * says it is reserved.
+ * If BIOS gave no map at all, the whole PHY_MM_SIZE is usable.
+ */
+static void pmm_init_ranges()
+{
+  unsigned long start, end;
+  int i;
+
+  if (!boot_e820_count){
+    pmm_add_range(FREE_PMM_START, PHY_MM_START + PHY_MM_SIZE);
+    return ;
+  }
+  for (i = 0; i < boot_e820_count; i++)
+    if (boot_e820_map[i].type == E820_TYPE_RAM
+        && !pmm_entry_range(boot_e820_map + i, &start, &end))
+      pmm_add_range(start, end);
+  for (i = 0; i < boot_e820_count; i++)
+    if (boot_e820_map[i].type != E820_TYPE_RAM
+        && !pmm_entry_range(boot_e820_map + i, &start, &end))
+      pmm_remove_range(start, end);
+}
+
 /*
  * Physical memory management init.
  * This function will be called only by mm_init.
- * Just insert all free pages into free lists.
+ * Setup memmap for every section which has usable memory, then insert all
+ * usable pages into free lists.
+ * The memmaps are placed at the head of the first usable range that can hold them.
  */
 void pmm_init()
 {
+  unsigned long start, end, sec, map_start = 0, map_end, map_size;
+  unsigned long count = 0;
   int i;
+
   for (i = 0; i < PMM_MAX_LEVE; ++i)
     INIT_LIST_HEAD(pmm_free_page_lists + i);
-  pmm_putback_remain(pmm_pages, FREE_PAGE_TOTAL);
+  INIT_LIST_HEAD(&pmm_shrinker_list);
+  pmm_init_ranges();
+
+  //1. which sections need memmap
+  for (i = 0; i < pmm_range_num; i++){
+    start = pmm_ranges[i].start;
+    end = pmm_ranges[i].end;
+    for (sec = start >> PMM_SECTION_SHIFT; sec <= (end - 1) >> PMM_SECTION_SHIFT; sec++)
+      if (!pmm_sections[sec]){
+        pmm_sections[sec] = (struct page *)1;
+        pmm_memmap_sections[count++] = sec;
+      }
+  }
+  map_size = count * PMM_SECTION_PAGES * sizeof(struct page);
+  map_size = (map_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+  //2. where to place memmaps
+  for (i = 0; i < pmm_range_num; i++){
+    start = pmm_ranges[i].start;
+    end = pmm_ranges[i].end;
+    if (end - start >= map_size){
+      map_start = start;
+      break;
+    }
+  }
+  assert(map_start);
+  map_end = map_start + map_size;
+  pmm_memmap = (struct page *)paddr_to_vaddr(map_start);
+  memset(pmm_memmap, 0, map_size);
+  for (i = 0; i < count; i++)
+    pmm_sections[pmm_memmap_sections[i]] = pmm_memmap + i * PMM_SECTION_PAGES;
+
+  //3. free all usable pages except memmaps
+  for (i = 0; i < pmm_range_num; i++){
+    start = pmm_ranges[i].start;
+    end = pmm_ranges[i].end;
+    if (start < map_end && end > map_start){
+      if (start < map_start)
+        pmm_free_range(start >> PAGE_SHIFT, (map_start - start) >> PAGE_SHIFT);
+      if (end > map_end)
+        pmm_free_range(map_end >> PAGE_SHIFT, (end - map_end) >> PAGE_SHIFT);
+    }else
+      pmm_free_range(start >> PAGE_SHIFT, (end - start) >> PAGE_SHIFT);
+    pmm_total_page += (end - start) >> PAGE_SHIFT;
+  }
+  pmm_useable_page = pmm_total_page - (map_size >> PAGE_SHIFT);
+  pmm_low_watermark = pmm_total_page / PMM_LOW_WATERMARK_DIV;
+  pmm_high_watermark = pmm_total_page / PMM_HIGH_WATERMARK_DIV;
 }
 
 /*
  * Address change functions.
  */
 unsigned long pmm_page_to_paddr(struct page * page){
-  return FREE_PMM_START + ((page - pmm_pages) << PAGE_SHIFT);
+  return pmm_page_to_pfn(page) << PAGE_SHIFT;
 }
 struct page * pmm_paddr_to_page(unsigned long address){
-  return pmm_pages + (address - FREE_PMM_START) / PAGE_SIZE;
+  return pmm_pfn_to_page(address >> PAGE_SHIFT);
 }
 
 /*
  * Alloc pages.
- * This function is not the interface of other modules since we need do something else if
- * we failed to alloc pages at first time.
- * So, this function may be called more than once when other modules try to alloc pages.
+ * Find the smallest free block which can hold "size" pages, split it down to the
+ * order we need and give back the tail we don't use.
+ * The smallest usable order is found by pmm_free_orders without walking any list.
  * Return the first page if successful or return NULL if no pages found.
  *
  * Note: "align" is the power of 2, but "size" is not.
  */
 static struct  page * pmm_do_alloc(unsigned long size, unsigned long align)
 {
-  struct page * cur = NULL, * ret = NULL;
-  unsigned long start_addr, align_addr, block_size, end_addr;
-  struct list_head * pos = NULL;
-  int i;
+  struct page * ret;
+  unsigned long order, cur, usable;
 
-  align = (1 << align) * PAGE_SIZE;
-  for (i = 0; i < PMM_MAX_LEVE; i++){
-    block_size = 1 << i;
-    if (size > block_size)
-      continue;
+  //a block of order n is always aligned to (1 << n) pages,
+  //so "align" is just the lower bound of order
+  order = size > 1 ? arch_bsr(size - 1) + 1 : 0;
+  if (order < align)
+    order = align;
+  if (order >= PMM_MAX_LEVE)
+    return NULL;
 
-    cur = NULL;
-    list_for_each(pos, pmm_free_page_lists + i){
-      cur = container_of(pos, struct page, page_list);
-
-      //check for align
-      start_addr = pmm_page_to_paddr(cur);
-      end_addr = pmm_page_to_paddr(cur + block_size);
-      align_addr = start_addr + (start_addr % align);
-      ret = pmm_paddr_to_page(align_addr);
-
-      //check size
-      if (block_size - (ret - cur) < size)
-        continue;
-
-      //get it
-      list_del(&(cur->page_list));
-      pmm_free_lists_count[i]--;
-      pmm_putback_remain(cur, ret - cur);
-      pmm_putback_remain(ret + size, block_size - (ret - cur) - size);
-      return ret;
-    }
+  usable = pmm_free_orders & ~((1UL << order) - 1);
+  if (!usable)
+    return NULL;
+  cur = arch_bsf(usable);
+
+  ret = container_of(pmm_free_page_lists[cur].next, struct page, page_list);
+  pmm_del_block(ret, cur);
+
+  //split, the high half goes back to lower free list
+  while (cur > order){
+    cur--;
+    pmm_add_block(pmm_pfn_to_page(pmm_page_to_pfn(ret) + (1UL << cur)), cur);
   }
-  return NULL;
+
+  //"size" may be not the power of 2
+  pmm_free_range(pmm_page_to_pfn(ret) + size, (1UL << order) - size);
+  return ret;
 }
 
 /*
- * Arrange free lists.
- * Merge adjacent pages in the same free list that address are continuous in order to get lager page block.
+ * Initate a shrinker.
  */
-static void pmm_do_arrange()
+void pmm_shrinker_init(struct pmm_shrinker * shrinker)
 {
-  struct list_head * cur_list = NULL;
-  struct page * cur_pages = NULL, * next_pages = NULL;
-  struct list_head * cur = NULL, * temp = NULL;
-  int i;
-  for (i = 0; i < PMM_MAX_LEVE; ++i){
-    cur_list = pmm_free_page_lists + i;
-
-    for (cur = cur_list->next;
-         cur != cur_list && cur->next != cur_list;
-         /* nor */ ){
-      cur_pages = container_of(cur, struct page, page_list);
-      next_pages = container_of(cur->next, struct page, page_list);
-
-      temp = cur->next;
-      if ((cur_pages + (1 << i)) == next_pages){
-        temp = temp->next;
-        list_del(cur);
-        list_del(cur->next);
-        pmm_insert_to(cur_list + 1, cur_pages);
-      }
-      cur = temp;
-    }
+  shrinker->priority = 0;
+  shrinker->shrink = NULL;
+  INIT_LIST_HEAD(&(shrinker->list));
+}
+
+/*
+ * Regist a shrinker, it will be called when memory is low.
+ * Shrinkers are kept in the order of priority.
+ */
+void pmm_shrinker_regist(struct pmm_shrinker * shrinker)
+{
+  struct list_head * cur;
+  struct pmm_shrinker * cur_shrinker;
+
+  list_for_each(cur, &pmm_shrinker_list){
+    cur_shrinker = container_of(cur, struct pmm_shrinker, list);
+    if (cur_shrinker->priority > shrinker->priority)
+      break;
   }
+  list_add_tail(&(shrinker->list), cur);
+}
+
+/*
+ * Unregist a shrinker.
+ */
+void pmm_shrinker_unregist(struct pmm_shrinker * shrinker)
+{
+  list_del(&(shrinker->list));
+  INIT_LIST_HEAD(&(shrinker->list));
+}
+
+/*
+ * Ask shrinkers to give back "nr_pages" pages.
+ * Shrinkers are called in the order of priority untill we get enough pages.
+ * Return the count of pages that freed.
+ *
+ * Note: shrinkers may alloc memory, but that will never call reclaim again.
+ */
+unsigned long pmm_reclaim(unsigned long nr_pages)
+{
+  struct list_head * cur;
+  struct pmm_shrinker * shrinker;
+  unsigned long freed = 0;
+
+  if (pmm_reclaiming)
+    return 0;
+  pmm_reclaiming = 1;
+  list_for_each(cur, &pmm_shrinker_list){
+    shrinker = container_of(cur, struct pmm_shrinker, list);
+    if (shrinker->shrink)
+      freed += shrinker->shrink(nr_pages - freed);
+    if (freed >= nr_pages)
+      break;
+  }
+  pmm_reclaiming = 0;
+  return freed;
 }
 
 /*
  * The interface of other modules to alloc pages.
- * If it failed to alloc pages at first time, it will call pmm_do_arrange and try again
+ * If there is no block big enough, we reclaim memory and try again.
+ * Memory is also reclaimed up to the high watermark once free pages go below
+ * the low watermark. Nothing is reclaimed if PMM_ALLOC_NORECLAIM is set in "flag".
  * Return first page if successful or return NULL if no pages found.
  */
-struct page * pmm_alloc_pages(unsigned long size, unsigned long align)
+struct page * pmm_alloc_pages(unsigned long size, unsigned long align, unsigned long flag)
 {
   struct page * ret = pmm_do_alloc(size,align);
   int i;
 
-  if (!ret){
-    pmm_do_arrange();
-    ret = pmm_do_alloc(size,align);
+  if (!ret && !(flag & PMM_ALLOC_NORECLAIM)){
+    pmm_reclaim(pmm_high_watermark + size);
+    ret = pmm_do_alloc(size, align);
   }
 
   if (ret){
@@ -209,6 +488,8 @@ struct page * pmm_alloc_pages(unsigned long size, unsigned long align)
       ret[i].count = 1;
       ret[i].type = PMM_PAGE_TYPE_NORMAL;
     }
+    if (pmm_useable_page < pmm_low_watermark && !(flag & PMM_ALLOC_NORECLAIM))
+      pmm_reclaim(pmm_high_watermark - pmm_useable_page);
   }
   return ret;
 }
@@ -219,10 +500,12 @@ struct page * pmm_alloc_pages(unsigned long size, unsigned long align)
 void pmm_free_pages(struct page * pages, unsigned long size)
 {
   int i;
-  pmm_putback_remain(pages,size);
+
+  assert(pages->type != PMM_PAGE_TYPE_FREE);
   for (i = 0; i < size; ++i){
     pages[i].count = 0;
     pages[i].private = NULL;
   }
+  pmm_free_range(pmm_page_to_pfn(pages), size);
   pmm_useable_page += size;
 }
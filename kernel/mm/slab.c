@@ -16,10 +16,12 @@
 #include <yatos/mm.h>
 #include <yatos/slab.h>
 #include <yatos/list.h>
+#include <yatos/pmm.h>
 #include <printk/string.h>
 
 static struct kcache kcache_cache; //The kache for manage all kcaches
 static struct list_head kcache_list; // All created kcaches
+static struct pmm_shrinker slab_shrinker;
 
 /*
  * The constructor for the object of "struct kcache".
@@ -30,6 +32,28 @@ void slab_kcache_constr(void * kcache)
   struct kcache * kc = (struct kcache *)kcache;
   INIT_LIST_HEAD(&(kc->full_cache));
   INIT_LIST_HEAD(&(kc->part_cache));
+  INIT_LIST_HEAD(&(kc->empty_cache));
+  kc->empty_count = 0;
+}
+
+/*
+ * Shrinker of slab.
+ * Give back the empty pages of all kcaches to pmm.
+ * Return the count of freed pages.
+ */
+static unsigned long slab_shrink_all(unsigned long nr_pages)
+{
+  struct list_head * cur;
+  struct kcache * cache;
+  unsigned long freed = 0;
+
+  list_for_each(cur, &kcache_list){
+    cache = container_of(cur, struct kcache, kc_list_entry);
+    freed += slab_shrink(cache);
+    if (freed >= nr_pages)
+      break;
+  }
+  return freed;
 }
 
 /*
@@ -41,23 +65,40 @@ void slab_init()
   slab_kcache_constr(&kcache_cache);
   kcache_cache.constr = slab_kcache_constr;
   kcache_cache.obj_size = sizeof(struct kcache);
+
+  pmm_shrinker_init(&slab_shrinker);
+  slab_shrinker.priority = PMM_SHRINK_PRIO_SLAB;
+  slab_shrinker.shrink = slab_shrink_all;
+  pmm_shrinker_regist(&slab_shrinker);
 }
 
 /*
  * Create a slab cache.
+ * "align" is the alignment of objects, it must be zero or power of 2.
+ * If "align" is not zero, objects of different pages will be coloured by the
+ * unused bytes at the end of page, so they don't always use the same cache lines.
+ * Without SLAB_CONSTRUCTED in "flags", objects are cleared and "constr" is called
+ * on every alloc, and "distr" is called on every free.
  * "constr" and "distr" are allowed to be NULL, but name is not.
  * Return new kcache if successful or return NULL if any error.
  */
-struct kcache * slab_create_cache(unsigned long size,cache_constr_fun constr,cache_distr_fun distr,
+struct kcache * slab_create_cache(unsigned long size, unsigned long align, unsigned long flags,
+                                  cache_constr_fun constr,cache_distr_fun distr,
                                   const char * name)
 {
   struct kcache * ret_kc;
 
   assert(name);
+  assert(!(align & (align - 1)));
 
   //size is not allowed to less than 16
   if (size < 16)
     size = 16;
+  //small object don't need to take a whole cache line
+  while (align > 16 && size <= align / 2)
+    align /= 2;
+  if (align)
+    size = (size + align - 1) & ~(align - 1);
 
   ret_kc = slab_alloc_obj(&kcache_cache);
   if (!ret_kc){
@@ -68,6 +109,22 @@ struct kcache * slab_create_cache(unsigned long size,cache_constr_fun constr,cac
   ret_kc->constr = constr;
   ret_kc->distr = distr;
   ret_kc->obj_size = size;
+  ret_kc->align = align;
+  //use the smallest slab that wastes not too much
+  ret_kc->order = 0;
+  while (ret_kc->order < SLAB_MAX_ORDER
+         && (slab_size(ret_kc) % size) * SLAB_WASTE_DIV > slab_size(ret_kc))
+    ret_kc->order++;
+  ret_kc->flags = flags;
+  //free list can not be in constructed objects
+  ret_kc->off_slab = size >= SLAB_OFF_SLAB_SIZE || (flags & SLAB_CONSTRUCTED);
+  ret_kc->magazine.count = 0;
+  ret_kc->magazine.limit = objs_per_slab(ret_kc) < SLAB_MAGAZINE_SIZE ?
+    objs_per_slab(ret_kc) : SLAB_MAGAZINE_SIZE;
+  ret_kc->colour_num = 1;
+  ret_kc->colour_next = 0;
+  if (align)
+    ret_kc->colour_num += (slab_size(ret_kc) % size) / colour_step(ret_kc);
   strncpy(ret_kc->name, name, 32);
   list_add_tail(&(ret_kc->kc_list_entry), &kcache_list);
 
@@ -75,31 +132,65 @@ struct kcache * slab_create_cache(unsigned long size,cache_constr_fun constr,cac
 }
 
 /*
- * Alloc a new page to increase userful space of "cache".
- * All object in new page will be linked into free list.
- * Return initated page if successful or return NULL if no page.
+ * Alloc a new slab to increase userful space of "cache".
+ * Every page of the slab points to the first page by "private", and the first page
+ * holds the slab_frame.
+ * All object in new slab will be linked into free list, starting at the colour
+ * offset of this slab. For off-slab kcache, the free list is a index stack alloced by
+ * mm_kmalloc, so the objects themself are never touched.
+ * Return the first page of initated slab if successful or return NULL if no memory.
  */
 static struct page * slab_get_new_page(struct kcache * cache)
 {
   struct page * new_page;
+  struct slab_frame * slab;
   struct list_head *cur_node;
   unsigned long cur_addr;
   int i;
 
-  new_page = pmm_alloc_one();
+  new_page = pmm_alloc_pages(1 << cache->order, cache->order, 0);
   if (!new_page){
     DEBUG("get NULL page in slab_get_new_page");
     return NULL;
   }
 
-  new_page->type = PMM_PAGE_TYPE_SLAB;
-  page_to_slab(new_page)->parent = cache;
-  INIT_LIST_HEAD(&(page_to_slab(new_page)->free_list));
+  slab = page_to_slab(new_page);
+  slab->parent = cache;
+  slab->inuse = 0;
+  slab->free_index = NULL;
+  INIT_LIST_HEAD(&(slab->free_list));
+  if (cache->off_slab){
+    slab->free_index = mm_kmalloc(objs_per_slab(cache) * sizeof(unsigned short));
+    if (!slab->free_index){
+      pmm_free_pages(new_page, 1 << cache->order);
+      return NULL;
+    }
+  }
+  for (i = 0; i < (1 << cache->order); i++){
+    new_page[i].type = PMM_PAGE_TYPE_SLAB;
+    new_page[i].private = new_page;
+  }
 
   cur_addr = paddr_to_vaddr(pmm_page_to_paddr(new_page));
-  for (i = 0;i < objs_per_page(cache); i++){
+  if (cache->colour_num > 1){
+    cur_addr += cache->colour_next * colour_step(cache);
+    cache->colour_next = (cache->colour_next + 1) % cache->colour_num;
+  }
+  slab->objs_start = cur_addr;
+  for (i = 0;i < objs_per_slab(cache); i++){
+    if (cache->flags & SLAB_CONSTRUCTED){
+      memset((void *)cur_addr, 0, cache->obj_size);
+      if (cache->constr)
+        cache->constr((void *)cur_addr);
+      cur_addr += cache->obj_size;
+    }
+    if (cache->off_slab){
+      //pop from the end, so the objects will be alloced in order of address
+      slab->free_index[i] = objs_per_slab(cache) - 1 - i;
+      continue;
+    }
     cur_node = (struct list_head *)cur_addr;
-    list_add_tail(cur_node, &(page_to_slab(new_page)->free_list));
+    list_add_tail(cur_node, &(slab->free_list));
     cur_addr += cache->obj_size;
   }
 
@@ -109,18 +200,46 @@ static struct page * slab_get_new_page(struct kcache * cache)
 }
 
 /*
- * Alloc a object from "cache".
- * This function will auto alloc new page if there is not free node.
- * Return useable object address if successful or return NULL if any error.
+ * Give back a empty slab of "cache" to pmm.
+ * Objects of SLAB_CONSTRUCTED kcache will be destructed here.
+ * The slab must have been removed from the page lists of "cache".
  */
-void * slab_alloc_obj(struct kcache* cache)
+static void slab_put_page(struct page * page)
+{
+  struct kcache * cache = page_to_slab(page)->parent;
+  int i;
+
+  if ((cache->flags & SLAB_CONSTRUCTED) && cache->distr)
+    for (i = 0; i < objs_per_slab(cache); i++)
+      cache->distr((void *)(page_to_slab(page)->objs_start + i * cache->obj_size));
+  if (cache->off_slab)
+    mm_kfree(page_to_slab(page)->free_index);
+  for (i = 0; i < (1 << cache->order); i++)
+    page[i].type = PMM_PAGE_TYPE_NORMAL;
+  pmm_free_pages(page, 1 << cache->order);
+}
+
+/*
+ * Get a free object from slabs of "cache".
+ * Empty slabs cached by "cache" are used before allocing new slab.
+ * This function will auto alloc new slab if there is not free node.
+ * Return the object if successful or return NULL if any error.
+ */
+static void * slab_get_obj(struct kcache* cache)
 {
   struct list_head * ret_page_list;
   struct page * ret_page;
-  struct list_head * ret_obj;
+  struct slab_frame * slab;
+  void * ret_obj;
   struct page * new_page;
 
-  //if there is no free node, we should alloc more page.
+  //if there is no free node, we should reuse a empty slab or alloc more slab.
+  if (list_empty(&(cache->part_cache)) && !list_empty(&(cache->empty_cache))){
+    new_page = container_of(cache->empty_cache.next, struct page, page_list);
+    list_del(&(new_page->page_list));
+    list_add_tail(&(new_page->page_list), &(cache->part_cache));
+    cache->empty_count--;
+  }
   if (list_empty(&(cache->part_cache))){
     new_page = slab_get_new_page(cache);
     if (!new_page){
@@ -129,54 +248,140 @@ void * slab_alloc_obj(struct kcache* cache)
     }
   }
 
-  //get the first free node in the first page of part_cache of cache;
+  //get the first free node in the first slab of part_cache of cache;
   ret_page_list = cache->part_cache.next;
   ret_page = container_of(ret_page_list, struct page, page_list);
-  ret_obj = page_to_slab(ret_page)->free_list.next;
-
-  list_del(ret_obj);
+  slab = page_to_slab(ret_page);
+  if (cache->off_slab)
+    ret_obj = (void *)(slab->objs_start
+                       + slab->free_index[objs_per_slab(cache) - slab->inuse - 1] * cache->obj_size);
+  else{
+    ret_obj = slab->free_list.next;
+    list_del((struct list_head *)ret_obj);
+  }
+  slab->inuse++;
 
   //if there is no free node in ret_page now,
   //we need to move ret_page to full_list of cache.
-  if (list_empty(&(page_to_slab(ret_page)->free_list))){
+  if (slab->inuse == objs_per_slab(cache)){
     list_del(ret_page_list);
     list_add_tail(ret_page_list, &(cache->full_cache));
   }
+  return ret_obj;
+}
+
+/*
+ * Alloc a object from "cache".
+ * The object is taken from magazine of "cache" if possible.
+ * Object of SLAB_CONSTRUCTED kcache is returned in constructed state.
+ * Return useable object address if successful or return NULL if any error.
+ */
+void * slab_alloc_obj(struct kcache* cache)
+{
+  void * ret_obj;
+
+  if (cache->magazine.count)
+    ret_obj = cache->magazine.objs[--cache->magazine.count];
+  else
+    ret_obj = slab_get_obj(cache);
+  if (!ret_obj)
+    return NULL;
+  if (cache->flags & SLAB_CONSTRUCTED)
+    return ret_obj;
   memset(ret_obj, 0, cache->obj_size);
 
   if (cache->constr)
-    cache->constr((void *)ret_obj);
+    cache->constr(ret_obj);
+
+  return ret_obj;
+}
+
+/*
+ * Give back a object to its slab.
+ * If the slab has no alloced objects any more, it will be moved to empty_cache,
+ * and given back to pmm if there are too many empty slabs.
+ */
+static void slab_put_obj(struct page * page, void * obj)
+{
+  unsigned long addr = (unsigned long)obj;
+  struct slab_frame * slab = page_to_slab(page);
+  struct kcache * cache = slab->parent;
+
+  if (slab->inuse == objs_per_slab(cache)){
+    list_del(&(page->page_list));
+    list_add_tail(&(page->page_list), &(cache->part_cache));
+  }
+
+  if (cache->off_slab)
+    slab->free_index[objs_per_slab(cache) - slab->inuse] = (addr - slab->objs_start) / cache->obj_size;
+  else
+    list_add_tail((struct list_head *)obj, &(slab->free_list));
+  if (--slab->inuse)
+    return ;
 
-  return (void *)ret_obj;
+  list_del(&(page->page_list));
+  if (cache->empty_count < SLAB_MAX_EMPTY_PAGES){
+    list_add_tail(&(page->page_list), &(cache->empty_cache));
+    cache->empty_count++;
+  }else
+    slab_put_page(page);
 }
 
 /*
  * Free object that alloced by slab_alloc_obj.
- * Note: this function never free page even if the page has no alloced objects any more.
+ * The object is kept in magazine of its kcache if there is room, otherwise it is
+ * given back to its slab.
  */
 void slab_free_obj(void* obj)
 {
-  unsigned long addr;
-  struct list_head * obj_list;
   struct page * page;
   struct kcache * cache;
 
   if (!obj)
     return ;
-  addr = (unsigned long)obj;
-  obj_list = (struct list_head*)addr;
-  page = vaddr_to_page(PAGE_ALIGN(addr));
+  page = (struct page *)vaddr_to_page(PAGE_ALIGN((unsigned long)obj))->private;
   cache = page_to_slab(page)->parent;
 
-  if (cache->distr)
+  if (cache->distr && !(cache->flags & SLAB_CONSTRUCTED))
     cache->distr(obj);
 
-  if (list_empty(&(page_to_slab(page)->free_list))){
-    list_del(&(page->page_list));
-    list_add_tail(&(page->page_list), &(cache->part_cache));
+  if (cache->magazine.count < cache->magazine.limit)
+    cache->magazine.objs[cache->magazine.count++] = obj;
+  else
+    slab_put_obj(page, obj);
+}
+
+/*
+ * Give back all objects in magazine of "cache" to their slabs.
+ */
+void slab_flush_magazine(struct kcache * cache)
+{
+  void * obj;
+
+  while (cache->magazine.count){
+    obj = cache->magazine.objs[--cache->magazine.count];
+    slab_put_obj((struct page *)vaddr_to_page(PAGE_ALIGN((unsigned long)obj))->private, obj);
   }
+}
 
-  list_add_tail(obj_list, &(page_to_slab(page)->free_list));
+/*
+ * Give back all empty slabs of "cache" to pmm.
+ * Magazine is flushed first, so the slabs only used by it can be freed too.
+ * Return the count of freed pages.
+ */
+unsigned long slab_shrink(struct kcache* cache)
+{
+  struct list_head * cur, * next;
+  unsigned long freed = 0;
+
+  slab_flush_magazine(cache);
+  list_for_each_safe(cur, next, &(cache->empty_cache)){
+    list_del(cur);
+    slab_put_page(container_of(cur, struct page, page_list));
+    freed += 1 << cache->order;
+  }
+  cache->empty_count = 0;
+  return freed;
 }
 
 /*
@@ -186,22 +391,22 @@ void slab_free_obj(void* obj)
 void slab_destory_cache(struct kcache* cache)
 {
   struct list_head * cur = NULL;
-  struct page * cur_page = NULL;
+  struct list_head * next = NULL;
 
   if (!cache){
     DEBUG("NULL cache\n\r");
     return ;
   }
 
-  list_for_each(cur, &(cache->full_cache)){
-    cur_page = container_of(cur, struct page, page_list);
-    pmm_free_one(cur_page);
-  }
+  slab_flush_magazine(cache);
+  //page_list will be reused by pmm, so we must get next node before free
+  list_for_each_safe(cur, next, &(cache->full_cache))
+    slab_put_page(container_of(cur, struct page, page_list));
 
-  list_for_each(cur, &(cache->part_cache)){
-    cur_page = container_of(cur, struct page, page_list);
-    pmm_free_one(cur_page);
-  }
+  list_for_each_safe(cur, next, &(cache->part_cache))
+    slab_put_page(container_of(cur, struct page, page_list));
+
+  slab_shrink(cache);
 
   list_del(&(cache->kc_list_entry));
   slab_free_obj(cache);
@@ -217,6 +422,6 @@ void slab_show_all_kcache()
 
   list_for_each(cur_list, &kcache_list){
     cache = container_of(cur_list, struct kcache, kc_list_entry);
-    printk("%10s size = %d\n\r", cache->name, cache->obj_size);
+    printk("%10s size = %d align = %d pages = %d\n\r", cache->name, cache->obj_size, cache->align, 1 << cache->order);
   }
 }
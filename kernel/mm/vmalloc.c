@@ -0,0 +1,164 @@
+/*
+ *  Virtually contiguous kernel memory.
+ *  Pages are alloced one by one, and mapped into VMALLOC_START ~ VMALLOC_END.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/2 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#include <yatos/vmalloc.h>
+#include <yatos/mm.h>
+#include <yatos/pmm.h>
+#include <yatos/printk.h>
+#include <arch/mmu.h>
+#include <arch/irq.h>
+
+static struct list_head vmalloc_area_list; //sorted by start_addr
+
+/*
+ * Initate vmalloc.
+ * All pet tables of vmalloc space are set up in the pdt of kernel now, before any
+ * task is created. Every task copy kernel pdt entries from its parent, so they
+ * share these pet tables and see all the maps made later.
+ */
+void vmalloc_init()
+{
+  unsigned long addr;
+  void * pet_table;
+
+  INIT_LIST_HEAD(&vmalloc_area_list);
+  for (addr = VMALLOC_START; addr < VMALLOC_END; addr += PAGE_SIZE * PET_MAX_NUM){
+    pet_table = mm_alloc_zero_page();
+    assert(pet_table);
+    set_pdt_entry(INIT_PDT_TABLE_START, addr, make_kernel_pdt(vaddr_to_paddr((unsigned long)pet_table)));
+  }
+  mmu_flush();
+}
+
+/*
+ * Find a free range of virtual space for "pages" pages.
+ * A unmapped guard page is left after every area to catch overflow.
+ * Return the area before which new area should be inserted, and set "start_addr".
+ * Return NULL and set "start_addr" to 0 if no space.
+ */
+static struct list_head * vmalloc_find_space(unsigned long pages, unsigned long * start_addr)
+{
+  struct list_head * cur;
+  struct vmalloc_area * area;
+  unsigned long addr = VMALLOC_START;
+
+  list_for_each(cur, &vmalloc_area_list){
+    area = container_of(cur, struct vmalloc_area, list_entry);
+    if (addr + (pages + 1) * PAGE_SIZE <= area->start_addr)
+      break;
+    addr = area->start_addr + (area->pages + 1) * PAGE_SIZE;
+  }
+  if (addr + (pages + 1) * PAGE_SIZE > VMALLOC_END){
+    *start_addr = 0;
+    return NULL;
+  }
+  *start_addr = addr;
+  return cur;
+}
+
+/*
+ * Unmap and free the first "pages" pages of area.
+ */
+static void vmalloc_free_pages(unsigned long start_addr, unsigned long pages)
+{
+  unsigned long i, paddr;
+
+  for (i = 0; i < pages; i++){
+    paddr = mmu_unmap(INIT_PDT_TABLE_START, start_addr + i * PAGE_SIZE);
+    if (paddr)
+      pmm_free_one(pmm_paddr_to_page(paddr));
+  }
+  mmu_flush_range(start_addr, start_addr + pages * PAGE_SIZE);
+}
+
+/*
+ * Alloc virtually contiguous memory from kernel.
+ * The pages are not physically contiguous, so this works even if memory is
+ * fragmented, but it is slower than mm_kmalloc. Use it for big buffers.
+ * Return address of memory if successful or return NULL if any error.
+ *
+ * Note: the memory can be freed by vfree or mm_kfree.
+ */
+void * vmalloc(unsigned long size)
+{
+  struct vmalloc_area * area;
+  struct list_head * next;
+  struct page * page;
+  unsigned long i;
+  uint32 save;
+
+  assert(size);
+  area = mm_kmalloc(sizeof(*area));
+  if (!area)
+    return NULL;
+  area->pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  save = arch_irq_save();
+  arch_irq_disable();
+  next = vmalloc_find_space(area->pages, &(area->start_addr));
+  if (next)
+    list_add_tail(&(area->list_entry), next);
+  arch_irq_recover(save);
+  if (!next){
+    DEBUG("vmalloc space is used up!\n");
+    mm_kfree(area);
+    return NULL;
+  }
+
+  for (i = 0; i < area->pages; i++){
+    page = pmm_alloc_one();
+    if (!page)
+      goto page_error;
+    mmu_map_kernel(area->start_addr + i * PAGE_SIZE, pmm_page_to_paddr(page));
+  }
+  return (void *)area->start_addr;
+
+ page_error:
+  vmalloc_free_pages(area->start_addr, i);
+  save = arch_irq_save();
+  arch_irq_disable();
+  list_del(&(area->list_entry));
+  arch_irq_recover(save);
+  mm_kfree(area);
+  return NULL;
+}
+
+/*
+ * Free memory that alloced by vmalloc.
+ */
+void vfree(void * addr)
+{
+  struct list_head * cur;
+  struct vmalloc_area * area = NULL;
+  uint32 save;
+
+  if (!addr)
+    return ;
+  save = arch_irq_save();
+  arch_irq_disable();
+  list_for_each(cur, &vmalloc_area_list){
+    area = container_of(cur, struct vmalloc_area, list_entry);
+    if (area->start_addr == (unsigned long)addr){
+      list_del(cur);
+      break;
+    }
+    area = NULL;
+  }
+  arch_irq_recover(save);
+  assert(area);
+
+  vmalloc_free_pages(area->start_addr, area->pages);
+  mm_kfree(area);
+}
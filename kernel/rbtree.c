@@ -0,0 +1,254 @@
+/*
+ *  Red-black tree
+ *  The position of new node is found by caller, so the tree can be sorted by any key.
+ *  Augmented data of nodes is kept up to date by the rb_augment_fun of caller.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/4 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+#include <yatos/rbtree.h>
+
+#define rb_is_red(node) ((node) && (node)->color == RB_RED)
+#define rb_is_black(node) (!rb_is_red(node))
+
+/*
+ * Replace "old" by "new" in the children of "parent".
+ */
+static void rb_change_child(struct rb_root * root, struct rb_node * parent,
+                            struct rb_node * old, struct rb_node * new)
+{
+  if (!parent)
+    root->node = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/*
+ * Rotate left at "node", the right child of "node" will take its place.
+ */
+static void rb_rotate_left(struct rb_root * root, struct rb_node * node, rb_augment_fun augment)
+{
+  struct rb_node * right = node->right;
+
+  node->right = right->left;
+  if (right->left)
+    right->left->parent = node;
+  right->parent = node->parent;
+  rb_change_child(root, node->parent, node, right);
+  right->left = node;
+  node->parent = right;
+  //the subtree has the same nodes, only these two need to be updated
+  if (augment){
+    augment(node);
+    augment(right);
+  }
+}
+
+/*
+ * Rotate right at "node", the left child of "node" will take its place.
+ */
+static void rb_rotate_right(struct rb_root * root, struct rb_node * node, rb_augment_fun augment)
+{
+  struct rb_node * left = node->left;
+
+  node->left = left->right;
+  if (left->right)
+    left->right->parent = node;
+  left->parent = node->parent;
+  rb_change_child(root, node->parent, node, left);
+  left->right = node;
+  node->parent = left;
+  if (augment){
+    augment(node);
+    augment(left);
+  }
+}
+
+/*
+ * Recompute augmented data from "node" to root.
+ */
+void rb_augment_path(struct rb_node * node, rb_augment_fun augment)
+{
+  if (!augment)
+    return ;
+  while (node){
+    augment(node);
+    node = node->parent;
+  }
+}
+
+/*
+ * Link "node" to "*link" which is a child pointer of "parent", and rebalance the tree.
+ * Caller should find "parent" and "link" by searching the tree with its key.
+ */
+void rb_insert(struct rb_root * root, struct rb_node * node, struct rb_node * parent,
+               struct rb_node ** link, rb_augment_fun augment)
+{
+  struct rb_node * gparent, * uncle;
+
+  node->parent = parent;
+  node->left = node->right = NULL;
+  node->color = RB_RED;
+  *link = node;
+  rb_augment_path(node, augment);
+
+  while (rb_is_red(parent = node->parent)){
+    //parent is red, so it's not root and gparent must exist
+    gparent = parent->parent;
+    if (parent == gparent->left){
+      uncle = gparent->right;
+      if (rb_is_red(uncle)){
+        parent->color = uncle->color = RB_BLACK;
+        gparent->color = RB_RED;
+        node = gparent;
+        continue;
+      }
+      if (node == parent->right){
+        rb_rotate_left(root, parent, augment);
+        node = parent;
+        parent = node->parent;
+      }
+      parent->color = RB_BLACK;
+      gparent->color = RB_RED;
+      rb_rotate_right(root, gparent, augment);
+    }else{
+      uncle = gparent->left;
+      if (rb_is_red(uncle)){
+        parent->color = uncle->color = RB_BLACK;
+        gparent->color = RB_RED;
+        node = gparent;
+        continue;
+      }
+      if (node == parent->left){
+        rb_rotate_right(root, parent, augment);
+        node = parent;
+        parent = node->parent;
+      }
+      parent->color = RB_BLACK;
+      gparent->color = RB_RED;
+      rb_rotate_left(root, gparent, augment);
+    }
+  }
+  root->node->color = RB_BLACK;
+}
+
+/*
+ * Rebalance the tree after a black node was removed from above "node".
+ * "node" may be NULL, so its parent is given by "parent".
+ */
+static void rb_erase_color(struct rb_root * root, struct rb_node * node,
+                           struct rb_node * parent, rb_augment_fun augment)
+{
+  struct rb_node * other;
+
+  while (rb_is_black(node) && node != root->node){
+    if (parent->left == node){
+      other = parent->right;
+      if (rb_is_red(other)){
+        other->color = RB_BLACK;
+        parent->color = RB_RED;
+        rb_rotate_left(root, parent, augment);
+        other = parent->right;
+      }
+      if (rb_is_black(other->left) && rb_is_black(other->right)){
+        other->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+        continue;
+      }
+      if (rb_is_black(other->right)){
+        other->left->color = RB_BLACK;
+        other->color = RB_RED;
+        rb_rotate_right(root, other, augment);
+        other = parent->right;
+      }
+      other->color = parent->color;
+      parent->color = RB_BLACK;
+      other->right->color = RB_BLACK;
+      rb_rotate_left(root, parent, augment);
+      node = root->node;
+      break;
+    }else{
+      other = parent->left;
+      if (rb_is_red(other)){
+        other->color = RB_BLACK;
+        parent->color = RB_RED;
+        rb_rotate_right(root, parent, augment);
+        other = parent->left;
+      }
+      if (rb_is_black(other->left) && rb_is_black(other->right)){
+        other->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+        continue;
+      }
+      if (rb_is_black(other->left)){
+        other->right->color = RB_BLACK;
+        other->color = RB_RED;
+        rb_rotate_left(root, other, augment);
+        other = parent->left;
+      }
+      other->color = parent->color;
+      parent->color = RB_BLACK;
+      other->left->color = RB_BLACK;
+      rb_rotate_right(root, parent, augment);
+      node = root->node;
+      break;
+    }
+  }
+  if (node)
+    node->color = RB_BLACK;
+}
+
+/*
+ * Remove "node" from tree and rebalance the tree.
+ */
+void rb_erase(struct rb_root * root, struct rb_node * node, rb_augment_fun augment)
+{
+  struct rb_node * child, * parent, * old;
+  unsigned long color;
+
+  if (!node->left || !node->right){
+    child = node->left ? node->left : node->right;
+    parent = node->parent;
+    color = node->color;
+    if (child)
+      child->parent = parent;
+    rb_change_child(root, parent, node, child);
+  }else{
+    //replace "old" by its successor
+    old = node;
+    node = node->right;
+    while (node->left)
+      node = node->left;
+    rb_change_child(root, old->parent, old, node);
+    child = node->right;
+    parent = node->parent;
+    color = node->color;
+    if (parent == old)
+      parent = node;
+    else{
+      if (child)
+        child->parent = parent;
+      parent->left = child;
+      node->right = old->right;
+      old->right->parent = node;
+    }
+    node->parent = old->parent;
+    node->color = old->color;
+    node->left = old->left;
+    old->left->parent = node;
+  }
+  rb_augment_path(parent, augment);
+  if (color == RB_BLACK)
+    rb_erase_color(root, child, parent, augment);
+}
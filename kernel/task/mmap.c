@@ -0,0 +1,444 @@
+/*
+ *  Memory map of user task.
+ *  mmap areas are anonymous or backed by data buffers of a regular file.
+ *  Private file pages are mapped from the data buffers and copied on write,
+ *  shared file pages are written in place and synced back by the inode.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/9 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#include <yatos/mmap.h>
+#include <yatos/task.h>
+#include <yatos/task_vmm.h>
+#include <yatos/fs.h>
+#include <yatos/mm.h>
+#include <yatos/sys_call.h>
+#include <yatos/schedule.h>
+#include <yatos/errno.h>
+#include <arch/regs.h>
+
+#define mmap_page_align(len) PAGE_ALIGN((len) + PAGE_SIZE - 1)
+
+/*
+ * Called when a file mapping area is copied by fork or split.
+ */
+static void mmap_area_open(struct task_vmm_area * area)
+{
+  struct mmap_info * info = (struct mmap_info *)area->private;
+  info->count++;
+}
+
+/*
+ * Called when a file mapping area is freed.
+ * The file is put by the last area of this mapping.
+ */
+static void mmap_area_close(struct task_vmm_area * area)
+{
+  struct mmap_info * info = (struct mmap_info *)area->private;
+
+  if (--info->count)
+    return ;
+  fs_put_file(info->file);
+  mm_kfree(info);
+}
+
+/*
+ * Get the data buffer of the page of "addr" in file mapping "area".
+ * Return NULL if the page is after the end of file or any error.
+ */
+static struct fs_data_buffer * mmap_get_buffer(struct task_vmm_area * area, unsigned long addr)
+{
+  struct mmap_info * info = (struct mmap_info *)area->private;
+  unsigned long offset = PAGE_ALIGN(addr) - info->base;
+
+  if (offset >= info->file->inode->size)
+    return NULL;
+  return fs_inode_get_buffer(info->file->inode, offset / FS_DATA_BUFFER_SIZE);
+}
+
+/*
+ * Fill a page of file mapping, the part after the end of file is left zero.
+ * This is only used if the data buffer can not be mapped directly.
+ */
+static void mmap_do_no_page(struct task_vmm_area * area, unsigned long addr, char * new_page)
+{
+  struct mmap_info * info = (struct mmap_info *)area->private;
+  struct fs_data_buffer * buf = mmap_get_buffer(area, addr);
+  unsigned long left;
+
+  if (!buf)
+    return ;
+  left = info->file->inode->size - (PAGE_ALIGN(addr) - info->base);
+  memcpy(new_page, buf->buffer, left < PAGE_SIZE ? left : PAGE_SIZE);
+}
+
+/*
+ * Check if the page of "addr" can be filled without reading disk.
+ * Anonymous pages are always ready.
+ */
+static int mmap_page_ready(struct task_vmm_area * area, unsigned long addr)
+{
+  struct mmap_info * info = (struct mmap_info *)area->private;
+  unsigned long offset;
+
+  if (!info)
+    return 1;
+  offset = PAGE_ALIGN(addr) - info->base;
+  if (offset >= info->file->inode->size)
+    return 1;
+  return fs_inode_find_buffer(info->file->inode, offset / FS_DATA_BUFFER_SIZE) != NULL;
+}
+
+/*
+ * Get the data buffer page to map at "addr".
+ * Buffers of a shared writeable mapping are marked dirty here, since writes to the
+ * mapped page never go through fs_write.
+ * Return virtual address of the page or return NULL if any error.
+ */
+static char * mmap_share_page(struct task_vmm_area * area, unsigned long addr)
+{
+  struct fs_data_buffer * buf = mmap_get_buffer(area, addr);
+
+  if (!buf)
+    return NULL;
+  if (area->flag & SECTION_SHARED){
+    BUFFER_SET_SHARED(buf);
+    if (area->flag & SECTION_WRITE)
+      BUFFER_SET_DIRTY(buf);
+  }
+  return buf->buffer;
+}
+
+/*
+ * Split "area" at "addr", the part after "addr" become a new area.
+ * Return the new area or return NULL if any error.
+ */
+static struct task_vmm_area * mmap_split_area(struct task_vmm_area * area, unsigned long addr)
+{
+  struct task_vmm_area * new_area = task_new_pure_area();
+  unsigned long len = area->len;
+
+  if (!new_area)
+    return NULL;
+  memcpy(new_area, area, sizeof(*area));
+  if (new_area->open)
+    new_area->open(new_area);
+  new_area->start_addr = addr;
+  new_area->len = area->start_addr + len - addr;
+
+  task_resize_area(area, addr - area->start_addr);
+  if (task_insert_area(area->mm_info, new_area)){
+    task_resize_area(area, len);
+    task_free_area(new_area);
+    return NULL;
+  }
+  return new_area;
+}
+
+/*
+ * Split areas at "start_addr" and "end_addr", so that all areas in this range can
+ * be changed as a whole.
+ * Return 0 if successful, return -EINVAL if any area in range is not created by
+ * mmap or a large page area is not split at 4MB boundary, or return -ENOMEM if
+ * any error.
+ */
+static int mmap_split_range(struct task_vmm_info * mm_info, unsigned long start_addr,
+                            unsigned long end_addr)
+{
+  struct task_vmm_area * area = task_vmm_find_area(mm_info, start_addr, end_addr);
+  struct task_vmm_area * last = area;
+  struct list_head * cur;
+
+  if (!area)
+    return 0;
+  for (cur = &(area->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    last = container_of(cur, struct task_vmm_area, list_entry);
+    if (last->start_addr >= end_addr)
+      break;
+    if (!(last->flag & SECTION_MMAP))
+      return -EINVAL;
+    if ((last->flag & SECTION_LARGE) && ((start_addr | end_addr) & (LARGE_PAGE_SIZE - 1)))
+      return -EINVAL;
+  }
+
+  if (area->start_addr < start_addr && !mmap_split_area(area, start_addr))
+    return -ENOMEM;
+  area = task_vmm_search_area(mm_info, end_addr - 1);
+  if (area->start_addr + area->len > end_addr && !mmap_split_area(area, end_addr))
+    return -ENOMEM;
+  return 0;
+}
+
+/*
+ * Check the range of munmap and mprotect.
+ * Return the page aligned end address or return 0 if the range is invalid.
+ */
+static unsigned long mmap_check_range(unsigned long addr, unsigned long len)
+{
+  unsigned long end = addr + mmap_page_align(len);
+
+  if ((addr & (PAGE_SIZE - 1)) || !len || end <= addr || end > TASK_USER_MMAP_END)
+    return 0;
+  return end;
+}
+
+/*
+ * System call of mmap.
+ * The arguments are passed by "struct mmap_arg" in user space.
+ * Return start address of mapping or return error code if any error.
+ *
+ * Note: MAP_FIXED can not replace any existing area, and the address hint is
+ *       ignored without MAP_FIXED.
+ *       MAP_HUGETLB mapping is 4MB aligned, and its length is rounded up to 4MB.
+ */
+static int sys_call_mmap(struct pt_regs * regs)
+{
+  struct mmap_arg * user_arg = (struct mmap_arg *)sys_call_arg1(regs);
+  struct task * task = task_get_cur();
+  struct task_vmm_info * mm_info = task->mm_info;
+  struct fs_file * file = NULL;
+  struct mmap_info * info = NULL;
+  struct task_vmm_area * area;
+  struct mmap_arg arg;
+  unsigned long len;
+  unsigned long align = PAGE_SIZE;
+  int share;
+
+  if (task_copy_from_user(&arg, user_arg, sizeof(arg)))
+    return -EFAULT;
+  len = mmap_page_align(arg.len);
+  share = arg.flags & (MAP_SHARED | MAP_PRIVATE);
+  if (!arg.len || !len || (arg.offset & (PAGE_SIZE - 1)) ||
+      (share != MAP_SHARED && share != MAP_PRIVATE))
+    return -EINVAL;
+  if (arg.flags & MAP_HUGETLB){
+    if (share != MAP_PRIVATE || !(arg.flags & MAP_ANONYMOUS))
+      return -EINVAL;
+    align = LARGE_PAGE_SIZE;
+    len = (len + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if (!len)
+      return -EINVAL;
+  }
+
+  if (!(arg.flags & MAP_ANONYMOUS)){
+    if (arg.fd < 0 || arg.fd >= MAX_OPEN_FD || !task->files[arg.fd])
+      return -EBADF;
+    file = task->files[arg.fd];
+    if (!S_ISREG(file->inode->mode))
+      return -ENODEV;
+    if ((file->flag & O_ACCMODE) == O_WRONLY ||
+        (share == MAP_SHARED && (arg.prot & PROT_WRITE) && (file->flag & O_ACCMODE) != O_RDWR))
+      return -EACCES;
+    info = mm_kmalloc(sizeof(*info));
+    if (!info)
+      return -ENOMEM;
+  }
+
+  if (arg.flags & MAP_FIXED){
+    if ((arg.addr & (align - 1)) || arg.addr < PAGE_SIZE || len > TASK_USER_MMAP_END ||
+        arg.addr > TASK_USER_MMAP_END - len){
+      mm_kfree(info);
+      return -EINVAL;
+    }
+    if (task_vmm_find_area(mm_info, arg.addr, arg.addr + len)){
+      mm_kfree(info);
+      return -EEXIST;
+    }
+    area = task_new_pure_area();
+    if (area){
+      area->start_addr = arg.addr;
+      area->len = len;
+      area->mm_info = mm_info;
+      task_insert_area(mm_info, area);
+    }
+  }else
+    area = task_alloc_area(mm_info, len, align);
+  if (!area){
+    mm_kfree(info);
+    return -ENOMEM;
+  }
+
+  area->flag = SECTION_ALLOC | SECTION_MMAP;
+  if (arg.prot & PROT_WRITE)
+    area->flag |= SECTION_WRITE;
+  if (arg.prot & PROT_EXEC)
+    area->flag |= SECTION_EXEC;
+  if (share == MAP_SHARED)
+    area->flag |= SECTION_SHARED;
+  if (arg.flags & MAP_HUGETLB)
+    area->flag |= SECTION_LARGE;
+  area->page_ready = mmap_page_ready;
+  if (!file){
+    area->flag |= SECTION_NOBITS;
+    return area->start_addr;
+  }
+
+  fs_get_file(file);
+  info->count = 1;
+  info->file = file;
+  info->base = area->start_addr - arg.offset;
+  area->private = info;
+  area->do_no_page = mmap_do_no_page;
+  area->share_page = mmap_share_page;
+  area->open = mmap_area_open;
+  area->close = mmap_area_close;
+  return area->start_addr;
+}
+
+/*
+ * System call of munmap.
+ * Remove all mmap areas in the range, areas across the range are split.
+ * Return 0 if successful or return error code if any error.
+ */
+static int sys_call_munmap(struct pt_regs * regs)
+{
+  unsigned long addr = (unsigned long)sys_call_arg1(regs);
+  unsigned long len = (unsigned long)sys_call_arg2(regs);
+  struct task_vmm_info * mm_info = task_get_cur()->mm_info;
+  struct task_vmm_area * area;
+  unsigned long end;
+  int ret;
+
+  end = mmap_check_range(addr, len);
+  if (!end)
+    return -EINVAL;
+  ret = mmap_split_range(mm_info, addr, end);
+  if (ret)
+    return ret;
+
+  ret = task_vmm_unmap_range(mm_info, addr, end);
+  if (ret)
+    return ret;
+  while ((area = task_vmm_find_area(mm_info, addr, end))){
+    task_remove_area(mm_info, area);
+    task_free_area(area);
+  }
+  return 0;
+}
+
+/*
+ * System call of mprotect.
+ * Change the protection of all mmap areas in the range.
+ * Return 0 if successful or return error code if any error.
+ *
+ * Note: every present user page is readable, so only PROT_WRITE is enforced.
+ */
+static int sys_call_mprotect(struct pt_regs * regs)
+{
+  unsigned long addr = (unsigned long)sys_call_arg1(regs);
+  unsigned long len = (unsigned long)sys_call_arg2(regs);
+  int prot = (int)sys_call_arg3(regs);
+  struct task_vmm_info * mm_info = task_get_cur()->mm_info;
+  struct task_vmm_area * area;
+  struct mmap_info * info;
+  struct list_head * cur;
+  unsigned long end;
+  int ret;
+
+  end = mmap_check_range(addr, len);
+  if (!end)
+    return -EINVAL;
+  ret = mmap_split_range(mm_info, addr, end);
+  if (ret)
+    return ret;
+
+  area = task_vmm_find_area(mm_info, addr, end);
+  //check permission of files first, nothing is changed if any error
+  for (cur = area ? &(area->list_entry) : NULL; cur && cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= end)
+      break;
+    info = (struct mmap_info *)area->private;
+    if (info && (area->flag & SECTION_SHARED) && (prot & PROT_WRITE) &&
+        (info->file->flag & O_ACCMODE) != O_RDWR)
+      return -EACCES;
+  }
+
+  area = task_vmm_find_area(mm_info, addr, end);
+  for (cur = area ? &(area->list_entry) : NULL; cur && cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= end)
+      break;
+    area->flag &= ~(SECTION_WRITE | SECTION_EXEC);
+    if (prot & PROT_WRITE)
+      area->flag |= SECTION_WRITE;
+    if (prot & PROT_EXEC)
+      area->flag |= SECTION_EXEC;
+  }
+
+  //pages become writeable again by write fault if areas allow
+  if (!(prot & PROT_WRITE))
+    task_vmm_protect_range(mm_info, addr, end);
+  return 0;
+}
+
+/*
+ * System call of madvise.
+ * MADV_DONTNEED and MADV_FREE drop all pages in the range now, and the next access
+ * fills them again like the first time: anonymous memory reads zero, and file
+ * mapping reads the file. MADV_FREE is only for private anonymous memory.
+ * Pages of shared anonymous memory are the only copy of data, so they are kept.
+ * Return 0 if successful or return error code if any error.
+ */
+static int sys_call_madvise(struct pt_regs * regs)
+{
+  unsigned long addr = (unsigned long)sys_call_arg1(regs);
+  unsigned long len = (unsigned long)sys_call_arg2(regs);
+  int advice = (int)sys_call_arg3(regs);
+  struct task_vmm_info * mm_info = task_get_cur()->mm_info;
+  struct task_vmm_area * area, * first;
+  struct list_head * cur;
+  unsigned long end, start_page, end_page;
+  int ret;
+
+  end = mmap_check_range(addr, len);
+  if (!end || (advice != MADV_DONTNEED && advice != MADV_FREE))
+    return -EINVAL;
+  first = task_vmm_find_area(mm_info, addr, end);
+  if (!first)
+    return -ENOMEM;
+
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= end)
+      break;
+    if ((area->flag & SECTION_LARGE) && ((addr | end) & (LARGE_PAGE_SIZE - 1)))
+      return -EINVAL;
+    if (advice == MADV_FREE && (!(area->flag & SECTION_NOBITS) || (area->flag & SECTION_SHARED)))
+      return -EINVAL;
+  }
+
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= end)
+      break;
+    if ((area->flag & SECTION_NOBITS) && (area->flag & SECTION_SHARED))
+      continue;
+    start_page = PAGE_ALIGN(area->start_addr);
+    end_page = PAGE_ALIGN(area->start_addr + area->len + PAGE_SIZE - 1);
+    ret = task_vmm_unmap_range(mm_info, start_page > addr ? start_page : addr,
+                               end_page < end ? end_page : end);
+    if (ret)
+      return ret;
+  }
+  return 0;
+}
+
+/*
+ * Initate memory map.
+ */
+void mmap_init()
+{
+  sys_call_regist(SYS_CALL_MMAP, sys_call_mmap);
+  sys_call_regist(SYS_CALL_MUNMAP, sys_call_munmap);
+  sys_call_regist(SYS_CALL_MPROTECT, sys_call_mprotect);
+  sys_call_regist(SYS_CALL_MADVISE, sys_call_madvise);
+}
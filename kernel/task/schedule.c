@@ -88,7 +88,8 @@ static void task_switch_to(struct task * prev, struct task *next)
 
 /*
  * This function select a new task and switch to it.
- * If there is no runable task, system will be halted and waitting for any irq.
+ * If there is no runable task, we fill the zero pool of mm, and system will be halted
+ * and waitting for any irq once the pool is full.
  */
 void task_schedule()
 {
@@ -97,7 +98,8 @@ void task_schedule()
   while (list_empty(run_list)){
     irq_save = arch_irq_save();
     arch_irq_enable();
-    system_hlt();
+    if (!mm_fill_zero_pool())
+      system_hlt();
     arch_irq_recover(irq_save);
   }
   struct task * next = container_of(run_list->next, struct task, run_list_entry);
@@ -106,6 +108,22 @@ void task_schedule()
   task_switch_to(pre, next);
 }
 
+/*
+ * Give up cpu but keep runable.
+ * Current task is moved to the end of time_up_list, so all other ready tasks run
+ * before it.
+ */
+void task_yield()
+{
+  uint32 irq_save = arch_irq_save();
+  arch_irq_disable();
+  list_del(&(task_current->run_list_entry));
+  list_add_tail(&(task_current->run_list_entry), time_up_list);
+  task_current->remain_click = MAX_TASK_RUN_CLICK;
+  arch_irq_recover(irq_save);
+  task_schedule();
+}
+
 /*
  * If task->need_sched was set, task_schedule() will be called.
  * This function will be called when the code stream return to user space.
@@ -216,3 +234,27 @@ struct task * task_find_by_pid(int pid)
   }
   return NULL;
 }
+
+/*
+ * Select the victim of out of memory.
+ * The task with the largest resident set is selected, init task and zombie tasks
+ * will never be selected.
+ * Return NULL if there is no task can be selected.
+ */
+struct task * task_oom_select()
+{
+  struct list_head * cur;
+  struct task * task;
+  struct task * victim = NULL;
+  unsigned long max_rss = 0;
+  list_for_each(cur, &task_list){
+    task = container_of(cur, struct task, task_list_entry);
+    if (task->pid == 1 || task->state == TASK_STATE_ZOMBIE)
+      continue;
+    if (task->mm_info->rss > max_rss){
+      max_rss = task->mm_info->rss;
+      victim = task;
+    }
+  }
+  return victim;
+}
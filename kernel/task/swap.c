@@ -0,0 +1,361 @@
+/*
+ *  Swap of anonymous user pages.
+ *  Pages of heap, stack and private mappings are written to swap devices when
+ *  memory is low, the compressed ram device first and then the swap partition
+ *  on the disk. Victims are selected by a clock scan over pet entries: a page
+ *  accessed since the last scan gets a second chance.
+ *  A swapped page may be mapped by many tasks after fork, so all of its pet
+ *  entries are found by searching the same address in every task_vmm_info.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/24 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#include <yatos/swap.h>
+#include <yatos/task_vmm.h>
+#include <yatos/task.h>
+#include <yatos/pmm.h>
+#include <yatos/mm.h>
+#include <yatos/vmalloc.h>
+#include <yatos/printk.h>
+#include <arch/disk.h>
+#include <arch/mmu.h>
+
+static struct swap_device * swap_devices[SWAP_DEVICE_MAX];
+static int swap_device_num;
+static struct swap_device swap_disk;
+static unsigned long swap_start_sector;
+static struct pmm_shrinker swap_shrinker;
+//clock hand of the scan
+static struct task_vmm_info * swap_hand;
+static unsigned long swap_hand_addr;
+
+/*
+ * Regist a swap device, "slots" of "dev" should be set.
+ * Return 0 if successful or return -1 if any error.
+ */
+int swap_regist_device(struct swap_device * dev)
+{
+  if (swap_device_num == SWAP_DEVICE_MAX || !dev->slots)
+    return -1;
+  if (dev->slots > SWAP_MAX_SLOTS)
+    dev->slots = SWAP_MAX_SLOTS;
+  dev->counts = (unsigned short *)vmalloc(dev->slots * sizeof(unsigned short));
+  if (!dev->counts)
+    return -1;
+  memset(dev->counts, 0, dev->slots * sizeof(unsigned short));
+  dev->cursor = 0;
+  swap_devices[swap_device_num++] = dev;
+  return 0;
+}
+
+/*
+ * Find a free slot of "dev".
+ * Slots are given out round robin from cursor, so we do not search from the
+ * start of a full device every time.
+ * Return the slot or return -1 if the device is full.
+ */
+static long swap_alloc_slot(struct swap_device * dev)
+{
+  unsigned long i, slot;
+
+  for (i = 0; i < dev->slots; i++){
+    slot = dev->cursor;
+    dev->cursor = dev->cursor + 1 < dev->slots ? dev->cursor + 1 : 0;
+    if (!dev->counts[slot])
+      return slot;
+  }
+  return -1;
+}
+
+/*
+ * Get the device and slot of a swapped pet entry.
+ * Return the device or return NULL if the entry is broken.
+ */
+static struct swap_device * swap_get_device(uint32 pet_e, unsigned long * slot)
+{
+  unsigned long index = get_swap_slot(pet_e) >> SWAP_DEVICE_SHIFT;
+  struct swap_device * dev;
+
+  *slot = get_swap_slot(pet_e) & (SWAP_MAX_SLOTS - 1);
+  if (index >= swap_device_num)
+    return NULL;
+  dev = swap_devices[index];
+  return *slot < dev->slots ? dev : NULL;
+}
+
+/*
+ * Read the page in slot of "pet_e" to "page".
+ * Return 0 if successful or return -1 if any error.
+ */
+int swap_read(uint32 pet_e, void * page)
+{
+  unsigned long slot;
+  struct swap_device * dev = swap_get_device(pet_e, &slot);
+
+  if (!dev || !dev->counts[slot])
+    return -1;
+  return dev->read(dev, slot, page);
+}
+
+/*
+ * A pet entry of swapped page is copied.
+ */
+void swap_dup(uint32 pet_e)
+{
+  unsigned long slot;
+  struct swap_device * dev = swap_get_device(pet_e, &slot);
+
+  if (dev)
+    dev->counts[slot]++;
+}
+
+/*
+ * A pet entry of swapped page is removed, the slot is free when nobody hold it.
+ */
+void swap_free(uint32 pet_e)
+{
+  unsigned long slot;
+  struct swap_device * dev = swap_get_device(pet_e, &slot);
+
+  if (!dev || !dev->counts[slot])
+    return ;
+  if (!--dev->counts[slot] && dev->release)
+    dev->release(dev, slot);
+}
+
+/*
+ * Store "page" in the first device that can take it.
+ * Return the slot with index of device or return -1 if all devices are full.
+ */
+static long swap_store_page(void * page)
+{
+  struct swap_device * dev;
+  long slot;
+  int i;
+
+  for (i = 0; i < swap_device_num; i++){
+    dev = swap_devices[i];
+    slot = swap_alloc_slot(dev);
+    if (slot < 0 || dev->write(dev, slot, page))
+      continue;
+    return ((unsigned long)i << SWAP_DEVICE_SHIFT) | slot;
+  }
+  return -1;
+}
+
+/*
+ * Called when "mm_info" is going to be freed, move the clock hand away from it.
+ */
+void swap_forget_vmm_info(struct task_vmm_info * mm_info)
+{
+  if (swap_hand != mm_info)
+    return ;
+  swap_hand = mm_info->list_entry.next == &task_vmm_info_list ? NULL :
+    container_of(mm_info->list_entry.next, struct task_vmm_info, list_entry);
+  swap_hand_addr = 0;
+}
+
+/*
+ * Write "page" mapped at "addr" to swap, and replace all of its pet entries.
+ * Pages of shared mapping are never swapped, since swap in gives a private copy.
+ * Return 0 if successful or return 1 if the page can not be swapped out.
+ */
+static int swap_out_page(struct task_vmm_info * mm_info, struct page * page,
+                         unsigned long addr)
+{
+  uint32 * pets[SWAP_RMAP_MAX];
+  uint32 * pet;
+  unsigned long paddr = pmm_page_to_paddr(page);
+  long slot;
+  struct task_vmm_area * area;
+  struct task_vmm_info * cur_mm;
+  struct list_head * cur;
+  int count = 0, i;
+
+  if ((unsigned long)page->private != addr)
+    return 1;
+  area = task_vmm_find_area(mm_info, addr, addr + PAGE_SIZE);
+  if (!area || (area->flag & SECTION_SHARED))
+    return 1;
+
+  //a page is only mapped at its own address, pet table shared by fork is found
+  //more than once
+  list_for_each(cur, &task_vmm_info_list){
+    cur_mm = container_of(cur, struct task_vmm_info, list_entry);
+    pet = task_vmm_get_pet(cur_mm, addr);
+    if (!pet || !pet_present(*pet) || get_page_addr(*pet) != paddr)
+      continue;
+    for (i = 0; i < count && pets[i] != pet; i++);
+    if (i < count)
+      continue;
+    if (count == SWAP_RMAP_MAX)
+      return 1;
+    pets[count++] = pet;
+  }
+  //somebody else is using this page, kernel or a mapping at other address
+  if (count != page->count)
+    return 1;
+
+  slot = swap_store_page((void *)paddr_to_vaddr(paddr));
+  if (slot < 0)
+    return 1;
+  for (i = 0; i < count; i++){
+    *pets[i] = make_swap_pet(slot, pet_writable(*pets[i]) ? 1 : 0);
+    swap_dup(*pets[i]);
+  }
+  list_for_each(cur, &task_vmm_info_list){
+    cur_mm = container_of(cur, struct task_vmm_info, list_entry);
+    pet = task_vmm_get_pet(cur_mm, addr);
+    if (pet && pet_swapped(*pet) && get_swap_slot(*pet) == (unsigned long)slot && cur_mm->rss)
+      cur_mm->rss--;
+  }
+  mmu_flush_page(addr);
+  for (i = 0; i < count; i++)
+    pmm_put_one(page);
+  return 0;
+}
+
+/*
+ * Shrinker of swap.
+ * The clock hand goes over user space of all tasks, accessed bit of a anonymous
+ * page is cleared at the first time, and the page is swapped out next time if it
+ * is not accessed again.
+ * Return the count of freed pages.
+ */
+static unsigned long swap_shrink(unsigned long nr_pages)
+{
+  unsigned long freed = 0, scanned = 0, addr;
+  int wraps = 0;
+  uint32 * pet;
+  uint32 pet_e;
+  struct page * page;
+  struct list_head * next;
+
+  if (list_empty(&task_vmm_info_list))
+    return 0;
+  if (!swap_hand){
+    swap_hand = container_of(task_vmm_info_list.next, struct task_vmm_info, list_entry);
+    swap_hand_addr = 0;
+  }
+
+  while (freed < nr_pages && scanned < SWAP_SCAN_MAX){
+    //go to the next task_vmm_info, at most two rounds
+    if (swap_hand_addr >= KERNEL_VMM_START){
+      next = swap_hand->list_entry.next;
+      if (next == &task_vmm_info_list){
+        if (++wraps > 1)
+          break;
+        next = next->next;
+      }
+      swap_hand = container_of(next, struct task_vmm_info, list_entry);
+      swap_hand_addr = 0;
+      continue;
+    }
+    //no pet table or large page, skip the whole 4MB
+    pet = task_vmm_get_pet(swap_hand, swap_hand_addr);
+    if (!pet){
+      swap_hand_addr = LARGE_PAGE_ALIGN(swap_hand_addr) + LARGE_PAGE_SIZE;
+      continue;
+    }
+    addr = swap_hand_addr;
+    swap_hand_addr += PAGE_SIZE;
+    pet_e = *pet;
+    if (!pet_present(pet_e))
+      continue;
+    page = pmm_paddr_to_page(get_page_addr(pet_e));
+    if (!page || page->type != PMM_PAGE_TYPE_ANON)
+      continue;
+    scanned++;
+    if (pet_accessed(pet_e)){
+      clr_accessed(pet_e);
+      *pet = pet_e;
+      mmu_flush_page(addr);
+      continue;
+    }
+    if (!swap_out_page(swap_hand, page, addr))
+      freed++;
+  }
+  return freed;
+}
+
+/*
+ * Write "page" to "slot" of swap partition.
+ */
+static int swap_disk_write(struct swap_device * dev, unsigned long slot, void * page)
+{
+  disk_write(swap_start_sector + slot * SWAP_SECTORS_PER_PAGE, SWAP_SECTORS_PER_PAGE,
+             (uint16 *)page);
+  return 0;
+}
+
+/*
+ * Read "slot" of swap partition to "page".
+ */
+static int swap_disk_read(struct swap_device * dev, unsigned long slot, void * page)
+{
+  disk_read(swap_start_sector + slot * SWAP_SECTORS_PER_PAGE, SWAP_SECTORS_PER_PAGE,
+            (uint16 *)page);
+  return 0;
+}
+
+/*
+ * Find the swap partition in partition table of the disk.
+ * Return 0 if found or return 1 if there is no swap partition.
+ */
+static int swap_find_partition(unsigned long * start, unsigned long * sectors)
+{
+  unsigned char * mbr = (unsigned char *)mm_kmalloc(512);
+  unsigned char * entry;
+  int i, ret = 1;
+
+  if (!mbr)
+    return 1;
+  disk_read(0, 1, (uint16 *)mbr);
+  if (mbr[510] == 0x55 && mbr[511] == 0xaa){
+    for (i = 0; i < 4; i++){
+      entry = mbr + 446 + i * 16;
+      if (entry[4] != SWAP_PART_TYPE)
+        continue;
+      *start = *(uint32 *)(entry + 8);
+      *sectors = *(uint32 *)(entry + 12);
+      ret = 0;
+      break;
+    }
+  }
+  mm_kfree(mbr);
+  return ret;
+}
+
+/*
+ * Initate swap.
+ * The compressed ram device is always used first, since disk is slow. The swap
+ * partition is used if there is one.
+ */
+void swap_init()
+{
+  unsigned long sectors;
+
+  zram_init();
+  if (!swap_find_partition(&swap_start_sector, &sectors)){
+    swap_disk.slots = sectors / SWAP_SECTORS_PER_PAGE;
+    swap_disk.write = swap_disk_write;
+    swap_disk.read = swap_disk_read;
+    if (!swap_regist_device(&swap_disk))
+      printk("swap: %d pages at sector %d\n", swap_disk.slots, swap_start_sector);
+  }
+  if (!swap_device_num)
+    return ;
+
+  pmm_shrinker_init(&swap_shrinker);
+  swap_shrinker.priority = PMM_SHRINK_PRIO_SWAP;
+  swap_shrinker.shrink = swap_shrink;
+  pmm_shrinker_regist(&swap_shrinker);
+}
@@ -24,6 +24,8 @@
 #include <yatos/fs.h>
 #include <yatos/errno.h>
 #include <yatos/signal.h>
+#include <yatos/mmap.h>
+#include <yatos/swap.h>
 
 char init_stack_space[KERNEL_STACK_SIZE];
 static struct task *init;
@@ -75,28 +77,24 @@ static void exec_bin_distr(void *arg)
 }
 
 /*
- * Fill a area of a page according to "vmm_area".
- * This function may read data from disk or fill all zero when the vmm_aera with the flag of
- * the SECTION_NOBITS.
- * This function will be called in page fault trap handler.
- *
- * Note: This is not the handler of page fault!.
+ * Get the part of "vmm_area" in the page of "fault_addr".
+ * "page_offset" is set to the offset in page, and "read_offset" is set to the offset
+ * in vmm_area.
+ * Return the length of the part.
  */
-static void task_do_no_page(struct task_vmm_area * vmm_area, unsigned long fault_addr, char * new_page)
+static uint32 task_area_in_page(struct task_vmm_area * vmm_area, unsigned long fault_addr,
+                                uint32 * page_offset, uint32 * read_offset)
 {
   uint32 fault_page_addr = PAGE_ALIGN(fault_addr);
-  uint32 page_offset, read_offset, read_len;
   uint32 left_max, right_min;
-  struct fs_file * file;
-  struct section * sec;
 
   if (vmm_area->start_addr < fault_page_addr){
-    page_offset = 0;
-    read_offset = fault_page_addr - vmm_area->start_addr;
+    *page_offset = 0;
+    *read_offset = fault_page_addr - vmm_area->start_addr;
     left_max = fault_page_addr;
   }else{
-    page_offset = vmm_area->start_addr - fault_page_addr;
-    read_offset = 0;
+    *page_offset = vmm_area->start_addr - fault_page_addr;
+    *read_offset = 0;
     left_max = vmm_area->start_addr;
   }
 
@@ -105,18 +103,86 @@ static void task_do_no_page(struct task_vmm_area * vmm_area, unsigned long fault
   else
     right_min = vmm_area->start_addr + vmm_area->len;
 
-  read_len = right_min - left_max;
+  return right_min - left_max;
+}
+
+/*
+ * Fill a area of a page according to "vmm_area".
+ * This function may read data from disk, but nothing need to do when the vmm_aera with
+ * the flag of the SECTION_NOBITS since "new_page" is already filled with zero.
+ * This function will be called in page fault trap handler.
+ *
+ * Note: This is not the handler of page fault!.
+ */
+static void task_do_no_page(struct task_vmm_area * vmm_area, unsigned long fault_addr, char * new_page)
+{
+  uint32 page_offset, read_offset, read_len;
+  struct fs_file * file;
+  struct section * sec;
+
+  read_len = task_area_in_page(vmm_area, fault_addr, &page_offset, &read_offset);
 
   file = task_get_cur()->bin->exec_file;
   sec = (struct section *)vmm_area->private;
-  if (vmm_area->flag & SECTION_NOBITS)
-    memset(new_page + page_offset,0 ,read_len);
-  else{
+  if (!(vmm_area->flag & SECTION_NOBITS)){
     fs_seek(file, sec->file_offset + read_offset, SEEK_SET);
     fs_read(file, new_page + page_offset, read_len);
   }
 }
 
+/*
+ * Check if task_do_no_page can fill the page of "addr" without reading disk.
+ * This function is used by fault-around.
+ * Return 1 if the data is already cached or nothing need to read, otherwise return 0.
+ */
+static int task_page_ready(struct task_vmm_area * vmm_area, unsigned long addr)
+{
+  uint32 page_offset, read_offset, read_len;
+  unsigned long offset, end;
+  struct fs_file * file;
+  struct section * sec;
+
+  if (vmm_area->flag & SECTION_NOBITS)
+    return 1;
+  read_len = task_area_in_page(vmm_area, addr, &page_offset, &read_offset);
+  if (!read_len)
+    return 1;
+
+  file = task_get_cur()->bin->exec_file;
+  sec = (struct section *)vmm_area->private;
+  offset = sec->file_offset + read_offset;
+  end = offset + read_len - 1;
+  for (offset /= FS_DATA_BUFFER_SIZE; offset <= end / FS_DATA_BUFFER_SIZE; offset++)
+    if (!fs_inode_find_buffer(file->inode, offset))
+      return 0;
+  return 1;
+}
+
+/*
+ * Get the cached file page that can be mapped directly at the page of "addr".
+ * This is possible only if the page of "addr" is page aligned in the exec file.
+ * The page may be read from disk, and no reference is taken.
+ * Return virtual address of the page or return NULL if we can not share.
+ */
+static char * task_share_page(struct task_vmm_area * vmm_area, unsigned long addr)
+{
+  unsigned long page_addr = PAGE_ALIGN(addr);
+  unsigned long delta;
+  struct fs_data_buffer * buf;
+  struct section * sec = (struct section *)vmm_area->private;
+
+  if (vmm_area->flag & SECTION_NOBITS)
+    return NULL;
+  //file offset of the page should be "page_addr - delta"
+  delta = vmm_area->start_addr - sec->file_offset;
+  if (delta % PAGE_SIZE || page_addr < delta)
+    return NULL;
+
+  buf = fs_inode_get_buffer(task_get_cur()->bin->exec_file->inode,
+                            (page_addr - delta) / FS_DATA_BUFFER_SIZE);
+  return buf ? buf->buffer : NULL;
+}
+
 /*
  * Setup the vmm area of user stack and add to "vmm_info".
  * Return 0 if successful or return -1 if any error.
@@ -126,6 +192,7 @@ static int task_init_stack(struct task_vmm_info * vmm_info, unsigned long stack_
   //set up area
   struct task_vmm_area * stack_area = task_new_pure_area();
   stack_area->do_no_page = task_do_no_page;
+  stack_area->page_ready = task_page_ready;
   stack_area->flag = SECTION_WRITE | SECTION_NOBITS;
   stack_area->mm_info = vmm_info;
   stack_area->start_addr = stack_addr - len;
@@ -147,6 +214,7 @@ static int task_init_heap(struct task_vmm_info * vmm_info, unsigned long heap_ad
   //set up heap
   struct task_vmm_area * heap_area = task_new_pure_area();
   heap_area->do_no_page = task_do_no_page;
+  heap_area->page_ready = task_page_ready;
   heap_area->flag = SECTION_WRITE | SECTION_NOBITS;
   heap_area->mm_info = vmm_info;
   heap_area->start_addr = heap_addr;
@@ -180,6 +248,8 @@ static int task_init_bin_areas(struct task_vmm_info * vmm_info, struct exec_bin
     cur_area->private = cur_sec;
     cur_area->mm_info = vmm_info;
     cur_area->do_no_page = task_do_no_page;
+    cur_area->page_ready = task_page_ready;
+    cur_area->share_page = task_share_page;
 
     if (task_insert_area(vmm_info, cur_area)){
       DEBUG("insert area error\n");
@@ -199,11 +269,12 @@ static void task_adopt(struct task * parent, struct task *child)
 }
 
 /*
- * System call of fork.
  * Clone a new task from current task.
- * Return 0 if successful or return error code if any error.
+ * If "share_vm" is set, the new task use the vmm_info of current task, and current
+ * task is blocked until the new task exec or exit.
+ * Return pid of new task if successful or return error code if any error.
  */
-static int sys_call_fork(struct pt_regs * regs)
+static int task_do_fork(int share_vm)
 {
   struct task * new_task = slab_alloc_obj(task_cache);
   struct task * cur_task = task_get_cur();
@@ -216,6 +287,7 @@ static int sys_call_fork(struct pt_regs * regs)
     return -ENOMEM;
   }
   memcpy(new_task, cur_task, sizeof(*new_task));
+  new_task->vfork_parent = NULL;
   new_task->pid = bitmap_alloc(task_map);
   INIT_LIST_HEAD(&(new_task->childs));
   INIT_LIST_HEAD(&(new_task->zombie_childs));
@@ -243,7 +315,11 @@ static int sys_call_fork(struct pt_regs * regs)
       fs_get_file(new_task->files[i]);
 
   //mm_info should be new, and should use copy on write
-  new_task->mm_info = task_vmm_clone_info(cur_task->mm_info);
+  if (share_vm){
+    new_task->mm_info = cur_task->mm_info;
+    task_get_vmm_info(new_task->mm_info);
+  }else
+    new_task->mm_info = task_vmm_clone_info(cur_task->mm_info);
   if (!new_task->mm_info){
     DEBUG("sys_call_fork can not clone vmm_info\n");
     ret = -ENOMEM;
@@ -268,6 +344,14 @@ static int sys_call_fork(struct pt_regs * regs)
   //make new_task scheduleable
   task_arch_init_run_context(new_task, 0);
 
+  //new task is using our vmm_info and user stack, wait until it exec or exit
+  if (share_vm){
+    new_task->vfork_parent = cur_task;
+    while (new_task->vfork_parent == cur_task){
+      task_block(cur_task);
+      task_schedule();
+    }
+  }
   return new_task->pid;
   //error
  sig_copy_error:
@@ -282,73 +366,163 @@ static int sys_call_fork(struct pt_regs * regs)
 }
 
 /*
- * Execve a new elf file.
- * This function will clear old vmm_info but not free it, then, the new content of
- * the vmm_info will be setup.
- * The fd with the flag of CLOSE_ON_EXCL will be closed.
+ * System call of fork.
+ * Clone a new task from current task.
+ * Return 0 if successful or return error code if any error.
  */
-static int task_do_execve(const char *path, char * argv[], char * envp[])
+static int sys_call_fork(struct pt_regs * regs)
+{
+  return task_do_fork(0);
+}
+
+/*
+ * System call of vfork.
+ * Same as fork, but the vmm_info is not copied, and current task is blocked until
+ * the new task exec or exit.
+ * Return 0 if successful or return error code if any error.
+ */
+static int sys_call_vfork(struct pt_regs * regs)
+{
+  return task_do_fork(1);
+}
+
+/*
+ * Copy "argv" from user space to "arg_buffer", which will be the top page of
+ * the new user stack. "buf" is a page for temporary use.
+ * Return 0 if successful or return -EINVAL if any error.
+ */
+static int task_setup_args(char * arg_buffer, char * buf, char * argv[])
 {
-  struct task * task = task_get_cur();
-  struct fs_file * file;
-  struct exec_bin * bin;
   int i;
-  char * buf = (char *)mm_kmalloc(PAGE_SIZE);
-  char * arg_buffer = (char *)mm_kmalloc(PAGE_SIZE);
-  int ret = 0;
   char ** cur;
   char * cur_arg;
   unsigned long len;
 
-  if (task_copy_str_from_user(buf, path, MAX_PATH_LEN)){
-    ret = -EINVAL;
-    goto get_path_error;
+  if (!argv)
+    return 0;
+  if (task_copy_pts_from_user(arg_buffer + 12, (void *)argv, MAX_ARG_NUM))
+    return -EINVAL;
+
+  cur = (char **)(arg_buffer + 12);// not +16 since cur[0] is not argv[0] but path_name
+  cur_arg = arg_buffer + PAGE_SIZE;
+  //1.argv[]
+  for (i = 0; i< MAX_ARG_NUM && cur[i]; i++){
+    //buf is useable now
+    if (task_copy_str_from_user(buf, cur[i], MAX_ARG_LEN))
+      return -EINVAL;
+
+    len = strnlen(buf, MAX_ARG_LEN);
+    cur_arg -= len + 1;
+    memcpy(cur_arg, buf, len);
+    cur_arg[len] = '\0';
+    cur[i] = (char *)(TASK_USER_STACK_START - PAGE_SIZE + (cur_arg - arg_buffer));
   }
+  //int main(int argc, char **argv)
+  //3. we should setup argc  and argv
+  //arg_buffer[0] is the return addr of user space _start
+  //but it is not nessary to init arg_buffer[0]
+  ((uint32 *)arg_buffer)[1] = i;
+  ((uint32 *)arg_buffer)[2] = TASK_USER_STACK_START - PAGE_SIZE + 12;
+  return 0;
+}
 
-  file = fs_open(buf, O_RDONLY, 0, &ret);
+/*
+ * Open and parse the elf file of user space "path".
+ * "buf" is a page for temporary use.
+ * Return the exec_bin or return NULL if any error, and "ret" is set to error code.
+ */
+static struct exec_bin * task_open_bin(const char * path, char * buf, int * ret)
+{
+  struct fs_file * file;
+  struct exec_bin * bin;
+
+  if (task_copy_str_from_user(buf, path, MAX_PATH_LEN)){
+    *ret = -EINVAL;
+    return NULL;
+  }
+  file = fs_open(buf, O_RDONLY, 0, ret);
   if (!file)
-    goto open_error;
+    return NULL;
   bin = elf_parse(file);
   if (!bin){
-    ret = -EINVAL;
-    goto elf_parse_error;
+    *ret = -EINVAL;
+    fs_put_file(file);
   }
+  return bin;
+}
 
-  //Set up args
-  if (argv){
-    if (task_copy_pts_from_user(arg_buffer + 12, (void *)argv, MAX_ARG_NUM)){
-      ret = -EINVAL;
-      goto setup_args_error;
+/*
+ * Close all the fds with the flag of CLOSE_ON_EXCL of "task".
+ */
+static void task_close_on_exec(struct task * task)
+{
+  int i;
+
+  for (i = 0; i < MAX_OPEN_FD; i++){
+    if (task->files[i] && bitmap_check(task->close_on_exec, i)){
+      bitmap_free(task->fd_map, i);
+      bitmap_free(task->close_on_exec, i);
+      fs_close(task->files[i]);
+      task->files[i] = NULL;
     }
+  }
+}
 
-    cur = (char **)(arg_buffer + 12);// not +16 since cur[0] is not argv[0] but path_name
-    cur_arg = arg_buffer + PAGE_SIZE;
-    //1.argv[]
-    for (i = 0; i< MAX_ARG_NUM && cur[i]; i++){
-      //buf is useable now
-      if (task_copy_str_from_user(buf, cur[i], MAX_ARG_LEN)){
-        ret = -EINVAL;
-        goto setup_args_error;
-      }
+/*
+ * Wake up the parent that blocked in vfork.
+ * This function is called when a vfork child stop using the vmm_info of parent.
+ */
+static void task_vfork_release(struct task * task)
+{
+  struct task * parent = task->vfork_parent;
+
+  if (!parent)
+    return ;
+  task->vfork_parent = NULL;
+  task_ready_to_run(parent);
+}
 
-      len = strnlen(buf, MAX_ARG_LEN);
-      cur_arg -= len + 1;
-      memcpy(cur_arg, buf, len);
-      cur_arg[len] = '\0';
-      cur[i] = (char *)(TASK_USER_STACK_START - PAGE_SIZE + (cur_arg - arg_buffer));
+/*
+ * Execve a new elf file.
+ * This function will clear old vmm_info but not free it, then, the new content of
+ * the vmm_info will be setup. A child of vfork gets a new vmm_info instead, since
+ * the old one is still used by its parent.
+ * The fd with the flag of CLOSE_ON_EXCL will be closed.
+ */
+static int task_do_execve(const char *path, char * argv[], char * envp[])
+{
+  struct task * task = task_get_cur();
+  struct exec_bin * bin;
+  struct task_vmm_info * mm_info;
+  char * buf = (char *)mm_kmalloc(PAGE_SIZE);
+  char * arg_buffer = (char *)mm_kmalloc(PAGE_SIZE);
+  int ret = 0;
+
+  bin = task_open_bin(path, buf, &ret);
+  if (!bin)
+    goto open_error;
+
+  //Set up args
+  ret = task_setup_args(arg_buffer, buf, argv);
+  if (ret)
+    goto setup_args_error;
+
+  //rebuild mm_info
+  if (task->mm_info->count > 1){
+    mm_info = task_vmm_create_info();
+    if (!mm_info){
+      ret = -ENOMEM;
+      goto setup_args_error;
     }
-    //int main(int argc, char **argv)
-    //3. we should setup argc  and argv
-    //arg_buffer[0] is the return addr of user space _start
-    //but it is not nessary to init arg_buffer[0]
-    ((uint32 *)arg_buffer)[1] = i;
-    ((uint32 *)arg_buffer)[2] = TASK_USER_STACK_START - PAGE_SIZE + 12;
-  }
+    task_put_vmm_info(task->mm_info);
+    task->mm_info = mm_info;
+    task_vmm_switch_to(task->mm_info, task->mm_info);
+    task_vfork_release(task);
+  }else
+    task_vmm_clear(task->mm_info);
+
   //now we can free old vmm_info
   task_put_bin(task->bin);
-
-  //rebuild mm_info
-  task_vmm_clear(task->mm_info);
   task->bin = bin;
 
   if (task_init_bin_areas(task->mm_info, task->bin)
@@ -364,14 +538,7 @@ static int task_do_execve(const char *path, char * argv[], char * envp[])
     goto init_area_error;
   }
   //files
-  for (i = 0; i < MAX_OPEN_FD; i++){
-    if (task->files[i] && bitmap_check(task->close_on_exec, i)){
-      bitmap_free(task->fd_map, i);
-      bitmap_free(task->close_on_exec, i);
-      fs_close(task->files[i]);
-      task->files[i] = NULL;
-    }
-  }
+  task_close_on_exec(task);
   //signal
   sig_task_exec(task);
   mm_kfree(buf);
@@ -380,14 +547,15 @@ static int task_do_execve(const char *path, char * argv[], char * envp[])
   //never back here
 
  init_area_error:
-  task_put_vmm_info(task->mm_info);
+  //old user space is gone, the task can not go back
+  sig_send(task, SIGKILL);
+  mm_kfree(arg_buffer);
+  mm_kfree(buf);
+  return ret;
 
  setup_args_error:
-  task_put_bin(task->bin);
- elf_parse_error:
-  fs_put_file(file);
+  task_put_bin(bin);
  open_error:
- get_path_error:
   mm_kfree(arg_buffer);
   mm_kfree(buf);
   return ret;
@@ -404,6 +572,167 @@ static int sys_call_execve(struct pt_regs * regs)
   return task_do_execve(path_name, argv, envp);
 }
 
+/*
+ * Do the fd actions of spawn on "task".
+ * Return 0 if successful or return -EINVAL if any error.
+ */
+static int task_spawn_fd_actions(struct task * task, struct spawn_action * actions, int count)
+{
+  int i, fd, new_fd;
+
+  for (i = 0; i < count; i++){
+    fd = actions[i].fd;
+    new_fd = actions[i].new_fd;
+    if (fd < 0 || fd >= MAX_OPEN_FD)
+      return -EINVAL;
+    switch (actions[i].type){
+    case SPAWN_ACTION_CLOSE:
+      if (!task->files[fd])
+        return -EINVAL;
+      fs_close(task->files[fd]);
+      task->files[fd] = NULL;
+      bitmap_free(task->fd_map, fd);
+      bitmap_free(task->close_on_exec, fd);
+      break;
+    case SPAWN_ACTION_DUP2:
+      if (new_fd < 0 || new_fd >= MAX_OPEN_FD || !task->files[fd])
+        return -EINVAL;
+      if (fd == new_fd){
+        bitmap_free(task->close_on_exec, fd);
+        break;
+      }
+      fs_get_file(task->files[fd]);
+      if (task->files[new_fd])
+        fs_close(task->files[new_fd]);
+      task->files[new_fd] = task->files[fd];
+      bitmap_set(task->fd_map, new_fd);
+      bitmap_free(task->close_on_exec, new_fd);
+      break;
+    default:
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+/*
+ * System call of spawn.
+ * Create a new task and execve "path" in it directly, the vmm_info of current task
+ * is never copied. Fds are inherited like fork, then "actions" are done in order
+ * before fds with the flag of CLOSE_ON_EXCL are closed.
+ * Return pid of new task if successful or return error code if any error.
+ */
+static int sys_call_spawn(struct pt_regs * regs)
+{
+  const char * path = (const char *)sys_call_arg1(regs);
+  char ** argv = (char **)sys_call_arg2(regs);
+  struct spawn_actions * user_actions = (struct spawn_actions *)sys_call_arg3(regs);
+  struct task * cur_task = task_get_cur();
+  struct task * new_task;
+  struct spawn_actions actions;
+  struct exec_bin * bin;
+  char * buf = (char *)mm_kmalloc(PAGE_SIZE);
+  char * arg_buffer = (char *)mm_alloc_zero_page();
+  unsigned long stack;
+  int ret = -ENOMEM;
+  int i;
+
+  if (!buf || !arg_buffer)
+    goto alloc_buffer_error;
+  actions.count = 0;
+  if (user_actions){
+    ret = -EINVAL;
+    if (task_copy_from_user(&actions, user_actions, sizeof(actions)))
+      goto alloc_buffer_error;
+    if (actions.count < 0 || actions.count > SPAWN_MAX_ACTIONS)
+      goto alloc_buffer_error;
+  }
+
+  bin = task_open_bin(path, buf, &ret);
+  if (!bin)
+    goto alloc_buffer_error;
+  ret = task_setup_args(arg_buffer, buf, argv);
+  if (ret)
+    goto setup_args_error;
+
+  ret = -ENOMEM;
+  new_task = slab_alloc_obj(task_cache);
+  if (!new_task)
+    goto setup_args_error;
+  memcpy(new_task, cur_task, sizeof(*new_task));
+  new_task->vfork_parent = NULL;
+  INIT_LIST_HEAD(&(new_task->childs));
+  INIT_LIST_HEAD(&(new_task->zombie_childs));
+  INIT_LIST_HEAD(&(new_task->wait_e_list));
+  new_task->remain_click = MAX_TASK_RUN_CLICK;
+  new_task->bin = bin;
+
+  stack = (unsigned long)mm_kmalloc(KERNEL_STACK_SIZE);
+  if (!stack)
+    goto alloc_stack_error;
+  new_task->kernel_stack = stack + KERNEL_STACK_SIZE;
+
+  //build user space, args are the top page of stack
+  new_task->mm_info = task_vmm_create_info();
+  if (!new_task->mm_info)
+    goto vmm_info_error;
+  if (task_init_bin_areas(new_task->mm_info, bin)
+      || task_init_stack(new_task->mm_info, TASK_USER_STACK_START, TASK_USER_STACK_LEN)
+      || task_init_heap(new_task->mm_info, TASK_USER_HEAP_START, TASK_USER_HEAP_DEAULT_LEN)
+      || task_vmm_install_page(new_task->mm_info, TASK_USER_STACK_START - PAGE_SIZE, arg_buffer))
+    goto init_area_error;
+  arg_buffer = NULL; //owned by mm_info now
+
+  //files
+  new_task->fd_map = bitmap_clone(cur_task->fd_map);
+  new_task->close_on_exec = bitmap_clone(cur_task->close_on_exec);
+  if (!new_task->fd_map || !new_task->close_on_exec)
+    goto bitmap_clone_error;
+  for (i = 0; i < MAX_OPEN_FD; i++)
+    if (new_task->files[i])
+      fs_get_file(new_task->files[i]);
+  ret = task_spawn_fd_actions(new_task, actions.actions, actions.count);
+  task_close_on_exec(new_task);
+  if (ret)
+    goto fd_actions_error;
+
+  //signal
+  ret = -ENOMEM;
+  if (sig_task_fork(new_task, cur_task))
+    goto fd_actions_error;
+  sig_task_exec(new_task);
+
+  new_task->pid = bitmap_alloc(task_map);
+  fs_get_file(new_task->cur_dir);
+  task_adopt(cur_task, new_task);
+  task_add_new_task(new_task);
+  task_arch_init_user_context(new_task, bin->entry_addr, TASK_USER_STACK_START - PAGE_SIZE);
+  mm_kfree(buf);
+  return new_task->pid;
+
+ fd_actions_error:
+  for (i = 0; i < MAX_OPEN_FD; i++)
+    if (new_task->files[i])
+      fs_close(new_task->files[i]);
+ bitmap_clone_error:
+  if (new_task->fd_map)
+    bitmap_destory(new_task->fd_map);
+  if (new_task->close_on_exec)
+    bitmap_destory(new_task->close_on_exec);
+ init_area_error:
+  task_put_vmm_info(new_task->mm_info);
+ vmm_info_error:
+  mm_kfree((void *)stack);
+ alloc_stack_error:
+  slab_free_obj(new_task);
+ setup_args_error:
+  task_put_bin(bin);
+ alloc_buffer_error:
+  mm_kfree(arg_buffer);
+  mm_kfree(buf);
+  return ret;
+}
+
 /*
  * This function move all the childs and zombie childs of "parent" to init task.
  * When a task exit but chlis still alive, all of it's chils will adopt to init task.
@@ -454,6 +783,8 @@ void task_exit(int status)
   task_tobe_zombie(task);
   task_leave_all_wq(task);
   task_adopt_orphans(task);
+  //parent of vfork can go on now
+  task_vfork_release(task);
   //we should sure this is the only onwer of mm_info
   if (task->mm_info->count == 1)
     task_vmm_clear(task->mm_info);
@@ -560,6 +891,23 @@ static int sys_call_waitpid(struct pt_regs * regs)
   return ret_pid;
 }
 
+/*
+ * Change the end address of user heap area to "new_end".
+ * If heap shrink, pages after the new end are unmapped and given back, but the page
+ * of the new end is kept since it is still used.
+ */
+static void task_set_heap_end(struct task_vmm_info * mm_info, unsigned long new_end)
+{
+  struct task_vmm_area * heap = mm_info->heap;
+  unsigned long old_end = heap->start_addr + heap->len;
+
+  task_resize_area(heap, new_end - heap->start_addr);
+  //if a shared pet table can not be copied, pages are left until task exit
+  if (new_end < old_end)
+    task_vmm_unmap_range(mm_info, PAGE_ALIGN(new_end + PAGE_SIZE - 1),
+                         PAGE_ALIGN(old_end + PAGE_SIZE - 1));
+}
+
 /*
  * System call of brk.
  * Change the end address of user heap area.
@@ -569,10 +917,15 @@ static int sys_call_brk(struct pt_regs * regs)
 {
   unsigned long addr = (unsigned long)sys_call_arg1(regs);
   struct task * task = task_get_cur();
+  unsigned long cur_end = task->mm_info->heap->start_addr + task->mm_info->heap->len;
+
   if (addr < task->mm_info->heap->start_addr ||
       addr > task->mm_info->stack->start_addr - task->mm_info->stack->len)
     return -EINVAL;
-  task->mm_info->heap->len = addr - task->mm_info->heap->start_addr;
+  //heap can not grow into other areas, such as mmap areas
+  if (addr > cur_end && task_vmm_find_area(task->mm_info, cur_end, addr))
+    return -ENOMEM;
+  task_set_heap_end(task->mm_info, addr);
   return 0;
 }
 
@@ -588,9 +941,12 @@ static int sys_call_sbrk(struct pt_regs * regs)
   unsigned long cur_end;
 
   cur_end = task->mm_info->heap->len + task->mm_info->heap->start_addr;
-  if (cur_end + incre > task->mm_info->stack->start_addr)
+  if (cur_end + incre > task->mm_info->stack->start_addr ||
+      (incre < 0 && (unsigned long)(-incre) > task->mm_info->heap->len))
     return -EINVAL;
-  task->mm_info->heap->len += incre;
+  if (incre > 0 && task_vmm_find_area(task->mm_info, cur_end, cur_end + incre))
+    return -ENOMEM;
+  task_set_heap_end(task->mm_info, cur_end + incre);
   return cur_end;
 
 }
@@ -642,6 +998,7 @@ static int sys_call_getpid(struct pt_regs * regs)
 
 /*
  * Constructor of "struct task_wait_qaueue".
+ * wait_queue_cache is a constructed cache, a queue must be empty when it is freed.
  */
 static void wait_queue_constr(void *arg)
 {
@@ -655,19 +1012,19 @@ static void wait_queue_constr(void *arg)
 void task_init()
 {
   task_arch_init();
-  task_cache = slab_create_cache(sizeof(struct task), task_constr, NULL, "task cache");
+  task_cache = slab_create_cache(sizeof(struct task), CACHE_LINE_SIZE, 0, task_constr, NULL, "task cache");
   assert(task_cache);
 
-  bin_cache = slab_create_cache(sizeof(struct exec_bin), exec_bin_constr, exec_bin_distr, "bin cache");
+  bin_cache = slab_create_cache(sizeof(struct exec_bin), 0, 0, exec_bin_constr, exec_bin_distr, "bin cache");
   assert(bin_cache);
 
-  section_cache = slab_create_cache(sizeof(struct section), NULL, NULL, "section cache");
+  section_cache = slab_create_cache(sizeof(struct section), 0, 0, NULL, NULL, "section cache");
   assert(section_cache);
 
-  wait_entry_cache = slab_create_cache(sizeof(struct task_wait_entry), NULL, NULL, "wait_entry cache");
+  wait_entry_cache = slab_create_cache(sizeof(struct task_wait_entry), CACHE_LINE_SIZE, 0, NULL, NULL, "wait_entry cache");
   assert(wait_entry_cache);
 
-  wait_queue_cache = slab_create_cache(sizeof(struct task_wait_queue), wait_queue_constr, NULL, "wait_queue cache");
+  wait_queue_cache = slab_create_cache(sizeof(struct task_wait_queue), CACHE_LINE_SIZE, SLAB_CONSTRUCTED, wait_queue_constr, NULL, "wait_queue cache");
   assert(wait_queue_cache);
 
   task_vmm_init();
@@ -685,6 +1042,10 @@ void task_init()
   sys_call_regist(SYS_CALL_GETPID,sys_call_getpid);
   sys_call_regist(SYS_CALL_BRK, sys_call_brk);
   sys_call_regist(SYS_CALL_CHDIR, sys_call_chdir);
+  sys_call_regist(SYS_CALL_VFORK, sys_call_vfork);
+  sys_call_regist(SYS_CALL_SPAWN, sys_call_spawn);
+  mmap_init();
+  swap_init();
 }
 
 /*
@@ -877,6 +1238,33 @@ void task_segment_fault(struct task * task)
   sig_send(task,SIGSEGV);
 }
 
+/*
+ * Out of memory killer.
+ * Kill the task with the largest resident set and give up cpu, the victim releases
+ * its user pages by itself in task_exit. We never release them here, since the
+ * victim may sleep in kernel with pointers into its mmu tables.
+ * Return 0 if the caller should retry the allocation or return -ENOMEM if nothing
+ * can be done.
+ *
+ * Note: if the victim is current task, it will exit when return to user space,
+ * and -ENOMEM is returned since its pages are still in use.
+ */
+int task_oom_kill()
+{
+  struct task * victim = task_oom_select();
+  if (!victim)
+    return -ENOMEM;
+  //a killed victim which is not exited yet is selected again, just wait for it
+  if (!sigset_check(victim->sig_info->pending, SIGKILL)){
+    printk("out of memory: kill task %d (rss %d pages)\n", victim->pid, victim->mm_info->rss);
+    sig_send(victim, SIGKILL);
+  }
+  if (victim == task_get_cur())
+    return -ENOMEM;
+  task_yield();
+  return 0;
+}
+
 /*
  * A gerner function for wake up.
  * Every wait_entry has it's wake_up function, but mostly, the function just call
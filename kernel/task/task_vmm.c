@@ -21,34 +21,46 @@
 #include <arch/mmu.h>
 #include <yatos/schedule.h>
 #include <yatos/errno.h>
+#include <yatos/swap.h>
 
 static struct kcache * vmm_info_cache;
 static struct kcache * vmm_area_cache;
 static struct irq_action page_fault_action;
+static unsigned long fault_around_pages = TASK_VMM_FAULT_AROUND_DEFAULT;
+static unsigned long zero_page_vaddr; //mapped readonly for read faults on anonymous pages
+struct list_head task_vmm_info_list;
 
 /*
  * Constructor of "struct task_vmm_info".
- * This function will be called when we alloc "struct task_vmm_info"
- * by slab_alloc_obj.
+ * vmm_info_cache is a constructed cache, this function is called only when slab
+ * get a new page, and task_free_vmm_info should give back object in this state.
  */
 static void vmm_info_constr(void *arg)
 {
   struct task_vmm_info * vmm = (struct task_vmm_info*)arg;
   vmm->count = 1;
   vmm->mm_table_vaddr = 0;
+  vmm->rss = 0;
   INIT_LIST_HEAD(&(vmm->vmm_area_list));
+  INIT_LIST_HEAD(&(vmm->list_entry));
+  rb_init_root(&(vmm->area_tree));
 }
 
 /*
- * Destructor of "struct task_vmm_info".
- * This function will be called when we free "struct task_vmm_info"
- * by slab_free_obj.
+ * Free a "struct task_vmm_info" that nobody use any more.
+ * All user pages and mmu tables will be freed, and vmm_info is given back to
+ * vmm_info_cache in constructed state.
  */
-static void vmm_info_distr(void *arg)
+void task_free_vmm_info(struct task_vmm_info * vmm)
 {
-  struct task_vmm_info * vmm = (struct task_vmm_info*)arg;
   task_vmm_clear(vmm);
+  swap_forget_vmm_info(vmm);
+  list_del(&(vmm->list_entry));
+  INIT_LIST_HEAD(&(vmm->list_entry));
   mm_kfree((void *)vmm->mm_table_vaddr);
+  vmm->mm_table_vaddr = 0;
+  vmm->count = 1;
+  slab_free_obj(vmm);
 }
 
 /*
@@ -74,6 +86,158 @@ static void vmm_area_distr(void *arg)
     area->close(area);
 }
 
+/*
+ * Alloc a page for user space.
+ * If there is no free memory even after reclaim, the oom killer will be called to
+ * kill other task, and we retry after it exits.
+ * Return virtual address of the page or return NULL if any error.
+ */
+static void * task_vmm_alloc_page(int zero)
+{
+  void * ret;
+  do{
+    ret = zero ? mm_alloc_zero_page() : mm_kmalloc(PAGE_SIZE);
+  }while (!ret && !task_oom_kill());
+  return ret;
+}
+
+/*
+ * Mark a new private page mapped at "addr" of user space, so it can be swapped out.
+ */
+static void task_vmm_set_anon(unsigned long page_vaddr, unsigned long addr)
+{
+  struct page * page = vaddr_to_page(page_vaddr);
+  page->type = PMM_PAGE_TYPE_ANON;
+  page->private = (void *)PAGE_ALIGN(addr);
+}
+
+/*
+ * Get the pet entry of "addr" in "mm_info".
+ * Return pointer to the entry or return NULL if there is no pet table, or "addr"
+ * is mapped by a large page.
+ */
+uint32 * task_vmm_get_pet(struct task_vmm_info * mm_info, unsigned long addr)
+{
+  uint32 pdt_e;
+
+  //pdt table of a new task_vmm_info may be not ready yet
+  if (!mm_info->mm_table_vaddr)
+    return NULL;
+  pdt_e = get_pdt_entry(mm_info->mm_table_vaddr, addr);
+  if (!pdt_present(pdt_e) || pdt_large(pdt_e))
+    return NULL;
+  return &get_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), addr);
+}
+
+/*
+ * Make the large page of "addr" private to "mm_info" and writeable.
+ * The whole 4MB is copied if it is still shared with others.
+ * Return 0 if successful or return -1 if any error.
+ */
+static int task_vmm_unshare_large(struct task_vmm_info * mm_info, unsigned long addr, uint32 pdt_e)
+{
+  struct page * page = pmm_paddr_to_page(get_large_page_addr(pdt_e));
+  struct page * new_page;
+  unsigned long new_paddr;
+
+  if (page->count == 1){
+    set_writable(pdt_e);
+  }else{
+    new_page = pmm_alloc_pages(LARGE_PAGE_NUM, LARGE_PAGE_SHIFT - PAGE_SHIFT, 0);
+    if (!new_page)
+      return -1;
+    new_paddr = pmm_page_to_paddr(new_page);
+    memcpy((void *)paddr_to_vaddr(new_paddr),
+           (void *)paddr_to_vaddr(get_large_page_addr(pdt_e)), LARGE_PAGE_SIZE);
+    pmm_put_pages(page, LARGE_PAGE_NUM);
+    pdt_e = make_large_pdt(new_paddr, 1);
+  }
+  set_pdt_entry(mm_info->mm_table_vaddr, addr, pdt_e);
+  mmu_flush_page(LARGE_PAGE_ALIGN(addr));
+  return 0;
+}
+
+/*
+ * Make the pet table of "addr" private to "mm_info" and its pdt entry writeable.
+ * Pet tables are shared readonly by fork, so the first write in their 4MB range
+ * copies the table, and all pages in it become copy on write.
+ * Return 0 if successful or return -1 if any error.
+ */
+static int task_vmm_unshare_pet(struct task_vmm_info * mm_info, unsigned long addr)
+{
+  uint32 pdt_e = get_pdt_entry(mm_info->mm_table_vaddr, addr);
+  uint32 * old_pet, * new_pet;
+  struct page * pet_page;
+  int i;
+
+  if (!pdt_present(pdt_e) || pet_writable(pdt_e))
+    return 0;
+  if (pdt_large(pdt_e))
+    return task_vmm_unshare_large(mm_info, addr, pdt_e);
+
+  old_pet = (uint32 *)paddr_to_vaddr(get_pet_addr(pdt_e));
+  pet_page = vaddr_to_page((unsigned long)old_pet);
+  if (pet_page->count == 1){
+    //others have copied it, but entries may be still writeable and skipped by
+    //task_vmm_protect_range, so they are made copy on write too
+    for (i = 0; i < PET_MAX_NUM; i++)
+      clr_writable(old_pet[i]);
+    set_writable(pdt_e);
+  }else{
+    new_pet = (uint32 *)task_vmm_alloc_page(0);
+    if (!new_pet)
+      return -1;
+    for (i = 0; i < PET_MAX_NUM; i++){
+      //swapped page is copied by swap in, each copy of entry hold the slot
+      if (pet_swapped(old_pet[i])){
+        clr_writable(old_pet[i]);
+        swap_dup(old_pet[i]);
+      }else if (old_pet[i]){
+        clr_writable(old_pet[i]);
+        pmm_get_one(pmm_paddr_to_page(get_page_addr(old_pet[i])));
+      }
+      new_pet[i] = old_pet[i];
+    }
+    pmm_put_one(pet_page);
+    pdt_e = make_pdt(vaddr_to_paddr((unsigned long)new_pet), 1);
+  }
+  set_pdt_entry(mm_info->mm_table_vaddr, addr, pdt_e);
+  mmu_flush();
+  return 0;
+}
+
+/*
+ * Map a page of user space, the pet table is copied first if it is shared.
+ * Return 0 if successful or return 1 if any error.
+ */
+static int task_vmm_map(struct task_vmm_info * mm_info, unsigned long addr, unsigned long paddr,
+                        unsigned long rw)
+{
+  if (task_vmm_unshare_pet(mm_info, addr))
+    return 1;
+  return mmu_map(mm_info->mm_table_vaddr, addr, paddr, rw);
+}
+
+/*
+ * Get the flags of all vmm_areas in the page of "page_addr".
+ * Return 0 if there is no area in this page.
+ */
+static unsigned long task_vmm_page_flag(struct task_vmm_info * mm_info, unsigned long page_addr)
+{
+  struct task_vmm_area * area = task_vmm_find_area(mm_info, page_addr, page_addr + PAGE_SIZE);
+  struct list_head * cur;
+  unsigned long flag = 0;
+
+  //areas never overlap, so all areas in this page follow the first one in list
+  for (cur = area ? &(area->list_entry) : NULL; cur && cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= page_addr + PAGE_SIZE)
+      break;
+    flag |= area->flag;
+  }
+  return flag;
+}
+
 /*
  * Deal with the page access fault.
  * If we found any no page fault in this function ,current task will be killed.
@@ -86,15 +250,26 @@ static int page_access_fault(unsigned long addr, uint32 ecode)
   uint32 pdt_e = get_pdt_entry(cur_task->mm_info->mm_table_vaddr, addr);
   uint32 pet_e;
   unsigned long page_paddr;
+  unsigned long flag;
   struct page * page;
+  struct task_vmm_area * area;
   unsigned long new_page_vaddr;
-  struct page * new_page;
 
   if (!pdt_e){
     task_segment_fault(cur_task);
     return -EFAULT;
   }
 
+  //large page has no pet table, copy on write is done for the whole 4MB
+  if (pdt_large(pdt_e)){
+    flag = task_vmm_page_flag(cur_task->mm_info, PAGE_ALIGN(addr));
+    if (!(flag & SECTION_WRITE) || task_vmm_unshare_pet(cur_task->mm_info, addr)){
+      task_segment_fault(cur_task);
+      return -EFAULT;
+    }
+    return 0;
+  }
+
   pet_e = get_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), addr);
   if (!pet_e){
     task_segment_fault(cur_task);
@@ -104,92 +279,359 @@ static int page_access_fault(unsigned long addr, uint32 ecode)
   page_paddr = get_pet_addr(pet_e);
   page = pmm_paddr_to_page(page_paddr);
 
-  //if page->private is 0, this page is readonly
+  //if no area in this page is writeable, this page is readonly
   //that is, this fault is a real access fault, we should kill task
-  if (!page->private){
+  flag = task_vmm_page_flag(cur_task->mm_info, PAGE_ALIGN(addr));
+  if (!(flag & SECTION_WRITE)){
     task_segment_fault(cur_task);
     return -EFAULT;
   }
   else{
+    //pet table may be shared with parent or child
+    if (!pet_writable(pdt_e)){
+      if (task_vmm_unshare_pet(cur_task->mm_info, addr)){
+        task_segment_fault(cur_task);
+        return -EFAULT;
+      }
+      pdt_e = get_pdt_entry(cur_task->mm_info->mm_table_vaddr, addr);
+      pet_e = get_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), addr);
+      if (pet_writable(pet_e))
+        return 0;
+    }
+
+    //the zero page is never written, give a new private page filled with zero
+    if (page == vaddr_to_page(zero_page_vaddr)){
+      new_page_vaddr = (unsigned long)task_vmm_alloc_page(1);
+      if (!new_page_vaddr){
+        task_segment_fault(cur_task);
+        return -EFAULT;
+      }
+      pmm_put_one(page);
+      if (task_vmm_map(cur_task->mm_info, addr, vaddr_to_paddr(new_page_vaddr), 1)){
+        task_segment_fault(cur_task);
+        return -EFAULT;
+      }
+      task_vmm_set_anon(new_page_vaddr, addr);
+      return 0;
+    }
+
     //now we should do copy on write
-    if (page->count == 1){ //we are the only one user of this page, so, it's not nessary to copy
+    //it's not nessary to copy if we are the only one user of this page,
+    //and pages of shared mapping are never copied
+    if (page->count == 1 || (flag & SECTION_SHARED)){
+      //the file page is written from now on, share_page marks its buffer dirty
+      area = task_vmm_find_area(cur_task->mm_info, addr, addr + 1);
+      if (area && (area->flag & SECTION_SHARED) && area->share_page)
+        area->share_page(area, addr);
       set_writable(pet_e);
       set_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), addr, pet_e);
       return 0;
     }
-    pmm_put_one(page);
-    new_page_vaddr = (unsigned long)mm_kmalloc(PAGE_SIZE);
+    //hold the old page, so it can not be swapped out by reclaim in alloc
+    pmm_get_one(page);
+    new_page_vaddr = (unsigned long)task_vmm_alloc_page(0);
     if (!new_page_vaddr){
+      pmm_put_one(page);
       task_segment_fault(cur_task);
       return -EFAULT;
     }
-    new_page = vaddr_to_page(new_page_vaddr);
-    new_page->private = (void *)1;
 
     memcpy((void*)new_page_vaddr, (void*)paddr_to_vaddr(page_paddr), PAGE_SIZE);
+    pmm_put_one(page);
+    pmm_put_one(page);
     //remap
-    if (mmu_map(cur_task->mm_info->mm_table_vaddr, addr, vaddr_to_paddr(new_page_vaddr), 1)){
+    if (task_vmm_map(cur_task->mm_info, addr, vaddr_to_paddr(new_page_vaddr), 1)){
       task_segment_fault(cur_task);
       return -EFAULT;
     }
+    task_vmm_set_anon(new_page_vaddr, addr);
   }
   return 0;
 }
 
 /*
- * This function deal with no-page fault.
- * This function will alloc a new page ,fill it, and make map.
- * Return 0 if successful or return -EFAULT if any error.
+ * Check if "addr" is already mapped in "mm_info".
  */
-static int  page_fault_no_page(unsigned long fault_addr)
+static int task_vmm_page_mapped(struct task_vmm_info * mm_info, unsigned long addr)
+{
+  uint32 pdt_e = get_pdt_entry(mm_info->mm_table_vaddr, addr);
+  if (!pdt_e)
+    return 0;
+  if (pdt_large(pdt_e))
+    return 1;
+  return get_pet_entry(paddr_to_vaddr(get_pet_addr(pdt_e)), addr) != 0;
+}
+
+/*
+ * Try to map a shared cached page at "page_addr".
+ * All areas in this page should agree on the same page, otherwise we can not share.
+ * The page is always mapped readonly, a writeable one will be copied on write
+ * unless the area is a shared mapping.
+ * Return 0 if successful or return 1 if we can not share.
+ */
+static int task_vmm_share_page(struct task_vmm_info * mm_info, struct task_vmm_area * first,
+                               unsigned long page_addr)
 {
-  struct task * cur_task = task_get_cur();
-  struct task_vmm_info * mm_info = cur_task->mm_info;
-  unsigned long fault_page_addr = PAGE_ALIGN(fault_addr);
-  uint32 new_page_vaddr = (uint32)mm_kmalloc(PAGE_SIZE);
-  uint32 new_page_paddr;
-  uint32 writeable = 0;
   struct list_head * cur;
-  struct task_vmm_area *area;
+  struct task_vmm_area * area;
+  char * shared = NULL, * cur_page;
   struct page * page;
 
-  if (!new_page_vaddr){
-    task_segment_fault(cur_task);
-    return -EFAULT;
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= page_addr + PAGE_SIZE)
+      break;
+    if (!area->share_page)
+      return 1;
+    cur_page = area->share_page(area, page_addr);
+    if (!cur_page || (shared && cur_page != shared))
+      return 1;
+    shared = cur_page;
   }
 
+  page = vaddr_to_page((unsigned long)shared);
+  pmm_get_one(page);
+  if (task_vmm_map(mm_info, page_addr, vaddr_to_paddr((unsigned long)shared), 0)){
+    pmm_put_one(page);
+    return 1;
+  }
+  mm_info->rss++;
+  return 0;
+}
+
+/*
+ * Try to map the zero page readonly at "page_addr".
+ * This is only possible if all areas in this page are private anonymous memory,
+ * the first write will replace it by a private page in page_access_fault.
+ * Return 0 if successful or return 1 if we can not use the zero page.
+ */
+static int task_vmm_zero_page(struct task_vmm_info * mm_info, struct task_vmm_area * first,
+                              unsigned long page_addr)
+{
+  struct list_head * cur;
+  struct task_vmm_area * area;
+  struct page * page = vaddr_to_page(zero_page_vaddr);
+
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= page_addr + PAGE_SIZE)
+      break;
+    if (!(area->flag & SECTION_NOBITS) || (area->flag & SECTION_SHARED))
+      return 1;
+  }
+
+  pmm_get_one(page);
+  if (task_vmm_map(mm_info, page_addr, vaddr_to_paddr(zero_page_vaddr), 0)){
+    pmm_put_one(page);
+    return 1;
+  }
+  mm_info->rss++;
+  return 0;
+}
+
+/*
+ * Check if all areas in the page of "page_addr" can fill it without reading disk.
+ */
+static int task_vmm_page_ready(struct task_vmm_info * mm_info, struct task_vmm_area * first,
+                               unsigned long page_addr)
+{
+  struct list_head * cur;
+  struct task_vmm_area * area;
+
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= page_addr + PAGE_SIZE)
+      break;
+    if (!area->page_ready || !area->page_ready(area, page_addr))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Alloc a new page for "page_addr", fill it by areas in this page, and make map.
+ * Cached file page is mapped directly if possible, and the zero page is mapped if
+ * "write" is not set and the page is anonymous.
+ * If "around" is set, this page is mapped by fault-around, so we never reclaim
+ * memory and give up if any area can not fill the page without reading disk.
+ * Return 0 if successful, return 1 if the page is skipped, or return -1 if any error.
+ */
+static int task_vmm_fill_page(struct task_vmm_info * mm_info, unsigned long page_addr,
+                              int write, int around)
+{
+  uint32 new_page_vaddr;
+  uint32 new_page_paddr;
+  uint32 writeable = 0;
+  struct list_head * cur;
+  struct task_vmm_area *first, *area;
+
+  //areas never overlap, so all areas in this page follow the first one in list
+  first = task_vmm_find_area(mm_info, page_addr, page_addr + PAGE_SIZE);
+  if (!first)
+    return around ? 1 : -1;
+
+  if (around && !task_vmm_page_ready(mm_info, first, page_addr))
+    return 1;
+
+  if (!task_vmm_share_page(mm_info, first, page_addr))
+    return 0;
+  if (!write && !task_vmm_zero_page(mm_info, first, page_addr))
+    return 0;
+
+  //pages of fault-around are optional, never reclaim for them, so buffers
+  //checked above can not be dropped
+  new_page_vaddr = (uint32)(around ? mm_alloc_zero_page_noreclaim() : task_vmm_alloc_page(1));
+  if (!new_page_vaddr)
+    return -1;
   new_page_paddr = vaddr_to_paddr(new_page_vaddr);
 
-  //now we should init the content of new page
+  //now we should init the content of new page, it is already filled with zero
   //content come from do_no_page function  of vmm_areas
   //if any vmm_area is writable, this page should be wirteable.
-  list_for_each(cur, &(mm_info->vmm_area_list)){
+  for (cur = &(first->list_entry); cur != &(mm_info->vmm_area_list); cur = cur->next){
     area = container_of(cur, struct task_vmm_area, list_entry);
-    if ((area->start_addr >= fault_page_addr
-         && area->start_addr < fault_page_addr + PAGE_SIZE)
-        ||
-        (area->start_addr + area->len >= fault_page_addr
-         && area->start_addr + area->len <= fault_page_addr + PAGE_SIZE)
-        ||
-        (area->start_addr < fault_page_addr
-         && area->start_addr + area->len >= fault_page_addr + PAGE_SIZE)){
-
-      if (area->flag & SECTION_WRITE)
-        writeable = 1;
-      if (area->do_no_page)
-        area->do_no_page(area,fault_addr, (char *)new_page_vaddr);
-    }else if (area->start_addr >= fault_page_addr + PAGE_SIZE)
+    if (area->start_addr >= page_addr + PAGE_SIZE)
       break;
+    if (area->flag & SECTION_WRITE)
+      writeable = 1;
+    if (area->do_no_page)
+      area->do_no_page(area, page_addr, (char *)new_page_vaddr);
   }
 
-  //for copy on wirte
-  page = pmm_paddr_to_page(new_page_paddr);
-  page->private = (void *)writeable;
-
   //now we setup mapping
-  if (mmu_map(mm_info->mm_table_vaddr, fault_addr, new_page_paddr, writeable)){
-    task_segment_fault(cur_task);
+  if (task_vmm_map(mm_info, page_addr, new_page_paddr, writeable)){
+    mm_kfree((void *)new_page_vaddr);
+    return -1;
+  }
+  task_vmm_set_anon(new_page_vaddr, page_addr);
+  mm_info->rss++;
+  return 0;
+}
+
+/*
+ * Try to map a 4MB large page for the fault at "addr".
+ * This is only done if the whole aligned 4MB is in one area with SECTION_LARGE and
+ * nothing is mapped in it yet. We never reclaim for it, small pages are used instead.
+ * Return 0 if successful or return 1 if we can not use large page.
+ */
+static int task_vmm_fill_large_page(struct task_vmm_info * mm_info, unsigned long addr)
+{
+  unsigned long start = LARGE_PAGE_ALIGN(addr);
+  struct task_vmm_area * area = task_vmm_find_area(mm_info, start, start + LARGE_PAGE_SIZE);
+  struct page * page;
+  unsigned long paddr;
+
+  if (!area || !(area->flag & SECTION_LARGE) || area->start_addr > start
+      || area->start_addr + area->len < start + LARGE_PAGE_SIZE)
+    return 1;
+  if (get_pdt_entry(mm_info->mm_table_vaddr, start))
+    return 1;
+
+  page = pmm_alloc_pages(LARGE_PAGE_NUM, LARGE_PAGE_SHIFT - PAGE_SHIFT, PMM_ALLOC_NORECLAIM);
+  if (!page)
+    return 1;
+  paddr = pmm_page_to_paddr(page);
+  memset((void *)paddr_to_vaddr(paddr), 0, LARGE_PAGE_SIZE);
+  set_pdt_entry(mm_info->mm_table_vaddr, start,
+                make_large_pdt(paddr, (area->flag & SECTION_WRITE) ? 1 : 0));
+  mmu_flush_page(start);
+  mm_info->rss += LARGE_PAGE_NUM;
+  return 0;
+}
+
+/*
+ * Read the swapped out page of "addr" back.
+ * The slot is copied to a new private page, so a page shared by copy on write
+ * before swap out is not shared any more.
+ * Return 0 if successful, return 1 if the page is not swapped, or return -1 if
+ * any error.
+ */
+static int task_vmm_swap_in(struct task_vmm_info * mm_info, unsigned long addr)
+{
+  uint32 * pet = task_vmm_get_pet(mm_info, addr);
+  uint32 pet_e;
+  unsigned long new_page_vaddr;
+
+  if (!pet || !pet_swapped(*pet))
     return 1;
+  //the page belongs to this task only after swap in, so pet table should be private
+  if (task_vmm_unshare_pet(mm_info, addr))
+    return -1;
+  pet = task_vmm_get_pet(mm_info, addr);
+  pet_e = *pet;
+  new_page_vaddr = (unsigned long)task_vmm_alloc_page(0);
+  if (!new_page_vaddr)
+    return -1;
+  if (swap_read(pet_e, (void *)new_page_vaddr)){
+    mm_kfree((void *)new_page_vaddr);
+    return -1;
+  }
+  //we may sleep in alloc and swap_read, the area may be unmapped and the pet
+  //table may be freed, so look up the entry again
+  pet = task_vmm_get_pet(mm_info, addr);
+  if (!pet || *pet != pet_e || !task_vmm_find_area(mm_info, addr, addr + PAGE_SIZE)){
+    mm_kfree((void *)new_page_vaddr);
+    return 0;
+  }
+  *pet = make_pet(vaddr_to_paddr(new_page_vaddr), pet_writable(pet_e) ? 1 : 0);
+  swap_free(pet_e);
+  task_vmm_set_anon(new_page_vaddr, addr);
+  mm_info->rss++;
+  return 0;
+}
+
+/*
+ * Set the number of pages in the fault-around window.
+ * "pages" is rounded down to power of 2, 0 or 1 disables fault-around.
+ */
+void task_vmm_set_fault_around(unsigned long pages)
+{
+  unsigned long n = 1;
+
+  while (n * 2 <= pages && n * 2 <= TASK_VMM_FAULT_AROUND_MAX)
+    n *= 2;
+  fault_around_pages = n;
+}
+
+/*
+ * This function deal with no-page fault.
+ * This function will alloc a new page ,fill it, and make map.
+ * Neighbouring pages in the aligned fault-around window are also mapped if they can
+ * be filled without reading disk, so that we take less page faults.
+ * Return 0 if successful or return -EFAULT if any error.
+ */
+static int  page_fault_no_page(unsigned long fault_addr, uint32 ecode)
+{
+  struct task * cur_task = task_get_cur();
+  struct task_vmm_info * mm_info = cur_task->mm_info;
+  unsigned long fault_page_addr = PAGE_ALIGN(fault_addr);
+  unsigned long window = fault_around_pages * PAGE_SIZE;
+  unsigned long start, addr;
+  int write = (ecode & 2) ? 1 : 0;
+  int ret;
+
+  ret = task_vmm_swap_in(mm_info, fault_page_addr);
+  if (ret < 0){
+    task_segment_fault(cur_task);
+    return -EFAULT;
+  }
+  if (!ret)
+    return 0;
+  if (!task_vmm_fill_large_page(mm_info, fault_addr))
+    return 0;
+  if (task_vmm_fill_page(mm_info, fault_page_addr, write, 0)){
+    task_segment_fault(cur_task);
+    return -EFAULT;
+  }
+
+  if (fault_around_pages <= 1)
+    return 0;
+  start = fault_page_addr & ~(window - 1);
+  for (addr = start; addr < start + window && addr < KERNEL_VMM_START; addr += PAGE_SIZE){
+    if (addr == fault_page_addr || task_vmm_page_mapped(mm_info, addr))
+      continue;
+    if (task_vmm_fill_page(mm_info, addr, write, 1) < 0)
+      break;
   }
   return 0;
 }
@@ -209,7 +651,7 @@ static int task_vmm_do_page_fault(unsigned long fault_addr, uint32 ecode)
   else if ((ecode & 1))
     return page_access_fault(fault_addr, ecode);
   else
-    return page_fault_no_page(fault_addr);
+    return page_fault_no_page(fault_addr, ecode);
 }
 
 /*
@@ -227,13 +669,18 @@ static void task_vmm_page_fault(void *private, struct pt_regs * irq_context)
  */
 void task_vmm_init()
 {
-  vmm_info_cache = slab_create_cache(sizeof(struct task_vmm_info), vmm_info_constr, vmm_info_distr, "vmm_info cache");
+  vmm_info_cache = slab_create_cache(sizeof(struct task_vmm_info), CACHE_LINE_SIZE, SLAB_CONSTRUCTED, vmm_info_constr, NULL, "vmm_info cache");
   assert(vmm_info_cache);
 
-  vmm_area_cache = slab_create_cache(sizeof(struct task_vmm_area), vmm_area_constr, vmm_area_distr,"vmm_area cache");
+  vmm_area_cache = slab_create_cache(sizeof(struct task_vmm_area), CACHE_LINE_SIZE, 0, vmm_area_constr, vmm_area_distr,"vmm_area cache");
   assert(vmm_area_cache);
 
+  zero_page_vaddr = (unsigned long)mm_alloc_zero_page();
+  assert(zero_page_vaddr);
+
   //init page fault
+  INIT_LIST_HEAD(&task_vmm_info_list);
+
   irq_action_init(&page_fault_action);
   page_fault_action.action = task_vmm_page_fault;
   irq_regist(IRQ_PAGE_FAULT, &page_fault_action);
@@ -244,7 +691,53 @@ void task_vmm_init()
  */
 struct task_vmm_info * task_new_vmm_info()
 {
-  return slab_alloc_obj(vmm_info_cache);
+  struct task_vmm_info * ret = slab_alloc_obj(vmm_info_cache);
+
+  if (ret)
+    list_add_tail(&(ret->list_entry), &task_vmm_info_list);
+  return ret;
+}
+
+/*
+ * Create a task_vmm_info with a new pdt table, and nothing is mapped in user space.
+ * Return the new task_vmm_info or return NULL if any error.
+ */
+struct task_vmm_info * task_vmm_create_info()
+{
+  struct task_vmm_info * ret = task_new_vmm_info();
+  uint32 * pdt;
+  int i;
+
+  if (!ret)
+    return NULL;
+  ret->mm_table_vaddr = (unsigned long)mm_alloc_zero_page();
+  if (!ret->mm_table_vaddr){
+    task_put_vmm_info(ret);
+    return NULL;
+  }
+  //kernel space is the same in all pdt tables
+  pdt = (uint32 *)ret->mm_table_vaddr;
+  for (i = USER_SPACE_PDT_MAX_NUM; i < PDT_MAX_NUM; i++)
+    pdt[i] = ((uint32 *)INIT_PDT_TABLE_START)[i];
+  return ret;
+}
+
+/*
+ * Map a filled kernel page at "addr" of "mm_info", which may be not the current one.
+ * The page is owned by "mm_info" now.
+ * Return 0 if successful or return -1 if any error.
+ */
+int task_vmm_install_page(struct task_vmm_info * mm_info, unsigned long addr, void * page)
+{
+  unsigned long flag = task_vmm_page_flag(mm_info, PAGE_ALIGN(addr));
+
+  if (!flag)
+    return -1;
+  if (task_vmm_map(mm_info, addr, vaddr_to_paddr((unsigned long)page), (flag & SECTION_WRITE) ? 1 : 0))
+    return -1;
+  task_vmm_set_anon((unsigned long)page, addr);
+  mm_info->rss++;
+  return 0;
 }
 
 struct task_vmm_area * task_get_pure_area()
@@ -252,54 +745,252 @@ struct task_vmm_area * task_get_pure_area()
   return slab_alloc_obj(vmm_area_cache);
 }
 
+/*
+ * Recompute max_end of a area in area_tree.
+ */
+static void task_area_augment(struct rb_node * node)
+{
+  struct task_vmm_area * area = rb_entry(node, struct task_vmm_area, rb_node);
+  struct task_vmm_area * child;
+
+  area->max_end = area->start_addr + area->len;
+  if (node->left){
+    child = rb_entry(node->left, struct task_vmm_area, rb_node);
+    if (child->max_end > area->max_end)
+      area->max_end = child->max_end;
+  }
+  if (node->right){
+    child = rb_entry(node->right, struct task_vmm_area, rb_node);
+    if (child->max_end > area->max_end)
+      area->max_end = child->max_end;
+  }
+}
+
 /*
  * Insert a vmm_area to vmm_info.
+ * The area is linked into area_tree, and into vmm_area_list after its previous area.
  * Return 0 if successful or return 1 if vmm_area overlap;
  */
 int task_insert_area(struct task_vmm_info* vmm_info,struct task_vmm_area* area)
 {
-  struct task_vmm_area * pre;
+  struct rb_node ** link = &(vmm_info->area_tree.node);
+  struct rb_node * parent = NULL;
+  struct task_vmm_area * pre = NULL;
+  struct task_vmm_area * cur;
 
-  if (list_empty(&(vmm_info->vmm_area_list))){
-      list_add_tail(&(area->list_entry), &(vmm_info->vmm_area_list));
-      return 0;
+  while (*link){
+    parent = *link;
+    cur = rb_entry(parent, struct task_vmm_area, rb_node);
+    if (area->start_addr < cur->start_addr)
+      link = &(parent->left);
+    else{
+      pre = cur;
+      link = &(parent->right);
+    }
+  }
+
+  if (task_vmm_find_area(vmm_info, area->start_addr, area->start_addr + area->len)){
+    printk("vmm area overlap!\n");
+    return 1;
   }
 
-  pre = task_vmm_search_area(vmm_info, area->start_addr);
   if (!pre)
     list_add(&(area->list_entry), &(vmm_info->vmm_area_list));
-  else{
-    if (pre->start_addr + pre->len > area->start_addr){
-      printk("vmm area overlap!\n");
-      return 1;
+  else
+    list_add(&(area->list_entry), &(pre->list_entry));
+  rb_insert(&(vmm_info->area_tree), &(area->rb_node), parent, link, task_area_augment);
+  return 0;
+}
+
+/*
+ * Remove a vmm_area from vmm_info, but the area is not freed.
+ */
+void task_remove_area(struct task_vmm_info * vmm_info, struct task_vmm_area * area)
+{
+  list_del(&(area->list_entry));
+  rb_erase(&(vmm_info->area_tree), &(area->rb_node), task_area_augment);
+}
+
+/*
+ * Change the length of a vmm_area that is in area_tree.
+ *
+ * Note: caller should make sure that the area will not overlap others.
+ */
+void task_resize_area(struct task_vmm_area * area, unsigned long len)
+{
+  area->len = len;
+  rb_augment_path(&(area->rb_node), task_area_augment);
+}
+
+/*
+ * Alloc a area of "len" bytes from the free vmm space below TASK_USER_MMAP_END.
+ * The space is searched from top to bottom, and the area is aligned to "align",
+ * which should be power of 2 and not less than PAGE_SIZE.
+ * Return the area that already inserted or return NULL if any error.
+ */
+struct task_vmm_area * task_alloc_area(struct task_vmm_info * mm_info, unsigned long len,
+                                       unsigned long align)
+{
+  struct list_head * cur;
+  struct task_vmm_area * area;
+  unsigned long end = TASK_USER_MMAP_END;
+  unsigned long area_end, start;
+
+  len = PAGE_ALIGN(len + PAGE_SIZE - 1);
+  if (!len || end < len + PAGE_SIZE)
+    return NULL;
+  list_for_each_prev(cur, &(mm_info->vmm_area_list)){
+    area = container_of(cur, struct task_vmm_area, list_entry);
+    if (area->start_addr >= end)
+      continue;
+    area_end = PAGE_ALIGN(area->start_addr + area->len + PAGE_SIZE - 1);
+    if (area_end <= ((end - len) & ~(align - 1)))
+      break;
+    end = PAGE_ALIGN(area->start_addr);
+    if (end < len + PAGE_SIZE)
+      return NULL;
+  }
+  start = (end - len) & ~(align - 1);
+  if (start < PAGE_SIZE)
+    return NULL;
+
+  area = task_new_pure_area();
+  if (!area)
+    return NULL;
+  area->start_addr = start;
+  area->len = len;
+  area->mm_info = mm_info;
+  if (task_insert_area(mm_info, area)){
+    task_free_area(area);
+    return NULL;
+  }
+  return area;
+}
+
+/*
+ * Unmap all pages in "start_addr" ~ "end_addr" and give them back.
+ * Both address should be page aligned.
+ * Return 0 if successful or return -ENOMEM if a shared pet table can not be copied.
+ */
+int task_vmm_unmap_range(struct task_vmm_info * mm_info, unsigned long start_addr,
+                         unsigned long end_addr)
+{
+  unsigned long addr, paddr;
+  uint32 pdt_e;
+  uint32 * pet;
+
+  for (addr = start_addr; addr < end_addr; addr += PAGE_SIZE){
+    //large page is always unmapped as a whole, see mmap_split_range
+    pdt_e = get_pdt_entry(mm_info->mm_table_vaddr, addr);
+    if (pdt_large(pdt_e)){
+      set_pdt_entry(mm_info->mm_table_vaddr, addr, 0);
+      pmm_put_pages(pmm_paddr_to_page(get_large_page_addr(pdt_e)), LARGE_PAGE_NUM);
+      mm_info->rss -= LARGE_PAGE_NUM;
+      addr = LARGE_PAGE_ALIGN(addr) + LARGE_PAGE_SIZE - PAGE_SIZE;
+      continue;
+    }
+    if (task_vmm_unshare_pet(mm_info, addr)){
+      mmu_flush_range(start_addr, addr);
+      return -ENOMEM;
     }
-    if (list_is_last(&(area->list_entry), &(vmm_info->vmm_area_list)))
-      list_add_tail(&(area->list_entry), &(vmm_info->vmm_area_list));
-    else
-      list_add(&(area->list_entry), &(pre->list_entry));
+    //swapped page is not counted in rss
+    pet = task_vmm_get_pet(mm_info, addr);
+    if (pet && pet_swapped(*pet)){
+      swap_free(*pet);
+      *pet = 0;
+      continue;
+    }
+    paddr = mmu_unmap(mm_info->mm_table_vaddr, addr);
+    if (!paddr)
+      continue;
+    pmm_put_one(pmm_paddr_to_page(paddr));
+    mm_info->rss--;
   }
+  mmu_flush_range(start_addr, end_addr);
   return 0;
 }
 
+/*
+ * Make all mapped pages in "start_addr" ~ "end_addr" readonly.
+ * A write fault will make it writeable again if the areas allow.
+ * Both address should be page aligned.
+ */
+void task_vmm_protect_range(struct task_vmm_info * mm_info, unsigned long start_addr,
+                            unsigned long end_addr)
+{
+  unsigned long addr, pet_table_vaddr;
+  uint32 pdt_e, pet_e;
+
+  for (addr = start_addr; addr < end_addr; addr += PAGE_SIZE){
+    pdt_e = get_pdt_entry(mm_info->mm_table_vaddr, addr);
+    //readonly pdt entry means a shared pet table, all its entries are made readonly
+    //when it is unshared, see task_vmm_unshare_pet
+    if (!pdt_present(pdt_e) || !pet_writable(pdt_e))
+      continue;
+    if (pdt_large(pdt_e)){
+      clr_writable(pdt_e);
+      set_pdt_entry(mm_info->mm_table_vaddr, addr, pdt_e);
+      addr = LARGE_PAGE_ALIGN(addr) + LARGE_PAGE_SIZE - PAGE_SIZE;
+      continue;
+    }
+    pet_table_vaddr = paddr_to_vaddr(get_pet_addr(pdt_e));
+    pet_e = get_pet_entry(pet_table_vaddr, addr);
+    if (!pet_present(pet_e) && !pet_swapped(pet_e))
+      continue;
+    clr_writable(pet_e);
+    set_pet_entry(pet_table_vaddr, addr, pet_e);
+  }
+  mmu_flush_range(start_addr, end_addr);
+}
+
 /*
  * Search the last vmm_area that vmm_area->start_addr <= "start_addr".
+ * Return NULL if not found.
  *
  * Note: the "start_addr" my not in target vmm_area.
  */
 struct task_vmm_area * task_vmm_search_area(struct task_vmm_info * mm_info, unsigned long start_addr)
 {
-  struct list_head *cur;
-  struct task_vmm_area * cur_area, *next_area;
+  struct rb_node * node = mm_info->area_tree.node;
+  struct task_vmm_area * cur, * ret = NULL;
 
-  list_for_each(cur, &(mm_info->vmm_area_list)){
-    cur_area = container_of(cur, struct task_vmm_area, list_entry);
-    if (cur_area->start_addr <= start_addr){
-      if (list_is_last(cur, &(mm_info->vmm_area_list)))
-        return cur_area;
-      next_area = container_of(cur->next, struct task_vmm_area, list_entry);
-      if (next_area->start_addr > start_addr)
-        return cur_area;
+  while (node){
+    cur = rb_entry(node, struct task_vmm_area, rb_node);
+    if (cur->start_addr <= start_addr){
+      ret = cur;
+      node = node->right;
+    }else
+      node = node->left;
+  }
+  return ret;
+}
+
+/*
+ * Find the first vmm_area that has any part in "start_addr" ~ "end_addr".
+ * max_end of subtree tells us if there is any area in left subtree ending after
+ * "start_addr", so this is done in O(log n).
+ * Return NULL if not found.
+ */
+struct task_vmm_area * task_vmm_find_area(struct task_vmm_info * mm_info, unsigned long start_addr,
+                                          unsigned long end_addr)
+{
+  struct rb_node * node = mm_info->area_tree.node;
+  struct task_vmm_area * cur;
+
+  while (node){
+    if (node->left
+        && rb_entry(node->left, struct task_vmm_area, rb_node)->max_end > start_addr){
+      node = node->left;
+      continue;
     }
+    cur = rb_entry(node, struct task_vmm_area, rb_node);
+    if (cur->start_addr >= end_addr)
+      return NULL;
+    if (cur->start_addr + cur->len > start_addr)
+      return cur;
+    node = node->right;
+    if (!node || rb_entry(node, struct task_vmm_area, rb_node)->max_end <= start_addr)
+      return NULL;
   }
   return NULL;
 }
@@ -323,10 +1014,10 @@ struct task_vmm_info * task_vmm_clone_info(struct task_vmm_info* from)
   struct list_head *cur;
   struct task_vmm_area * cur_area;
   struct task_vmm_area * new_area;
-  uint32 * src_pdt, * des_pdt, *des_pet, * src_pet;
-  uint32 pdt_e, new_page_vaddr, new_page_paddr;
+  uint32 * src_pdt, * des_pdt;
+  uint32 pdt_e;
   struct page *page;
-  int i,j;
+  int i;
 
   if (!ret)
     return NULL;
@@ -338,59 +1029,49 @@ struct task_vmm_info * task_vmm_clone_info(struct task_vmm_info* from)
       goto new_area_error;
     memcpy(new_area, cur_area, sizeof(*cur_area));
     new_area->mm_info = ret;
-    list_add_tail(&(new_area->list_entry), &(ret->vmm_area_list));
+    if (new_area->open)
+      new_area->open(new_area);
+    if (task_insert_area(ret, new_area)){
+      task_free_area(new_area);
+      goto new_area_error;
+    }
 
     if (cur_area == from->heap)
       ret->heap = new_area;
     if (cur_area == from->stack)
       ret->stack = new_area;
   }
+  //all the pages are shared by copy on write
+  ret->rss = from->rss;
 
   //get new pdt table
-  ret->mm_table_vaddr = (unsigned long)mm_kmalloc(PAGE_SIZE);
+  ret->mm_table_vaddr = (unsigned long)mm_alloc_zero_page();
   if (!ret->mm_table_vaddr)
     goto pdt_table_error;
-  memset((void *)ret->mm_table_vaddr, 0, PAGE_SIZE);
 
-  //clone all pet table and setup copy on write
   src_pdt = (uint32 *)from->mm_table_vaddr;
   des_pdt = (uint32 *)ret->mm_table_vaddr;
   //1. copy all kernel space pdt
   for (i = USER_SPACE_PDT_MAX_NUM; i < PDT_MAX_NUM; i++)
     des_pdt[i] = src_pdt[i];
-  //2. clone user space and set up copy on write
+  //2. share all pet tables and large pages readonly, they are copied by the first
+  //   write fault in their range, see task_vmm_unshare_pet
   for (i = 0; i < USER_SPACE_PDT_MAX_NUM; i++){
     pdt_e = src_pdt[i];
     if (!pdt_e)
       continue;
-    new_page_vaddr = (uint32)mm_kmalloc(PAGE_SIZE);
-    if (!new_page_vaddr)
-      goto pdt_table_error;
-
-    new_page_paddr = vaddr_to_paddr(new_page_vaddr);
-    des_pdt[i] = make_pdt(new_page_paddr, 1);
-
-    //set up copy on write
-    des_pet = (uint32 *)new_page_vaddr;
-    src_pet = (uint32 *)paddr_to_vaddr(get_pet_addr(src_pdt[i]));
-    memcpy(des_pet, src_pet, PAGE_SIZE);
-    for (j = 0; j < PET_MAX_NUM; j++){
-      if (!des_pet[j])
-        continue;
-      clr_writable(des_pet[j]);
-      clr_writable(src_pet[j]); //src also need be readonly
-      page = pmm_paddr_to_page(get_page_addr(des_pet[j]));
-      pmm_get_one(page);
-    }
+    clr_writable(pdt_e);
+    src_pdt[i] = pdt_e;
+    des_pdt[i] = pdt_e;
+    page = pmm_paddr_to_page(get_pet_addr(pdt_e));
+    pmm_get_one(page);
   }
+  mmu_flush();
   return ret;
 
  pdt_table_error:
  new_area_error:
-  list_for_each(cur, &(ret->vmm_area_list)){
-    cur_area = container_of(cur, struct task_vmm_area, list_entry);
-    task_free_area(cur_area);
-  }
+  //all areas will be freed by task_vmm_clear
   task_put_vmm_info(ret);
   return NULL;
 }
@@ -411,13 +1092,23 @@ static int task_check_user_space(unsigned long addr, unsigned long count, unsign
     if (!pdt_present(pdt_e) && task_vmm_do_page_fault(page_vaddr, 4))
       return -EFAULT;
     pdt_e = get_pdt_entry(task->mm_info->mm_table_vaddr, page_vaddr);
+    //large page has no pet table
+    if (pdt_large(pdt_e)){
+      if (rw && !pet_writable(pdt_e) && task_vmm_do_page_fault(page_vaddr, 7))
+        return -EFAULT;
+      page_vaddr += PAGE_SIZE;
+      continue;
+    }
 
     pet_table_vaddr = paddr_to_vaddr(get_pet_addr(pdt_e));
     pet_e = get_pet_entry(pet_table_vaddr, page_vaddr);
     if (!pet_present(pet_e) && task_vmm_do_page_fault(page_vaddr, 4))
       return -EFAULT;
+    //pet table may be copied by page fault
+    pdt_e = get_pdt_entry(task->mm_info->mm_table_vaddr, page_vaddr);
+    pet_table_vaddr = paddr_to_vaddr(get_pet_addr(pdt_e));
     pet_e = get_pet_entry(pet_table_vaddr, page_vaddr);
-    if (!pet_writable(pet_e) && rw && task_vmm_do_page_fault(page_vaddr, 7))
+    if (rw && (!pet_writable(pdt_e) || !pet_writable(pet_e)) && task_vmm_do_page_fault(page_vaddr, 7))
       return -EFAULT;
 
     page_vaddr += PAGE_SIZE;
@@ -472,6 +1163,10 @@ void task_vmm_clear(struct task_vmm_info* vmm)
     area = container_of(cur, struct task_vmm_area, list_entry);
     slab_free_obj(area);
   }
+  rb_init_root(&(vmm->area_tree));
+  vmm->heap = NULL;
+  vmm->stack = NULL;
+  vmm->rss = 0;
   // clean mm table
   pdt_table = (uint32 *)vmm->mm_table_vaddr;
   if (!pdt_table)
@@ -480,15 +1175,32 @@ void task_vmm_clear(struct task_vmm_info* vmm)
 
     if (!pdt_table[i])
       continue;
+    //large page, may be shared by fork too
+    if (pdt_large(pdt_table[i])){
+      page = pmm_paddr_to_page(get_large_page_addr(pdt_table[i]));
+      pdt_table[i] = 0;
+      pmm_put_pages(page, LARGE_PAGE_NUM);
+      continue;
+    }
     pet_table = (uint32 *)paddr_to_vaddr(get_pet_addr(pdt_table[i]));
+    pdt_table[i] = 0;
+    //pet table shared by fork, pages belong to the other users
+    page = vaddr_to_page((unsigned long)pet_table);
+    if (page->count > 1){
+      pmm_put_one(page);
+      continue;
+    }
     for (j = 0; j < PET_MAX_NUM; j++){
       if (!pet_table[j])
         continue;
+      if (pet_swapped(pet_table[j])){
+        swap_free(pet_table[j]);
+        continue;
+      }
       page_paddr = get_page_addr(pet_table[j]);
       page = pmm_paddr_to_page(page_paddr);
       pmm_put_one(page);
     }
-    pdt_table[i] = 0;
     mm_kfree(pet_table);
   }
   mmu_flush();
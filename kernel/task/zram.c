@@ -0,0 +1,118 @@
+/*
+ *  Compressed ram swap device.
+ *  Swapped pages are compressed by lz and kept in memory, the compressed data is
+ *  alloced by mm_kmalloc, so it is packed by the size classes of kmalloc.
+ *  Pages that can not be compressed to half are left to the next device.
+ *
+ *  Copyright (C) 2017 ese@ccnt.zju
+ *
+ *  ---------------------------------------------------
+ *  Started at 2017/8/26 by Ray
+ *
+ *  ---------------------------------------------------
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License.
+ */
+
+#include <yatos/swap.h>
+#include <yatos/lz.h>
+#include <yatos/pmm.h>
+#include <yatos/mm.h>
+#include <yatos/vmalloc.h>
+#include <yatos/printk.h>
+
+#define ZRAM_MEM_DIV 4 //compressed data use at most 1/4 of memory
+#define ZRAM_MAX_LEN (PAGE_SIZE / 2)
+
+struct zram_slot
+{
+  unsigned char * data;
+  unsigned long len;
+};
+
+static struct swap_device zram_device;
+static struct zram_slot * zram_table;
+static unsigned char * zram_buffer; //page is compressed here first, since we don't know the size
+static unsigned long zram_used; //bytes of compressed data
+static unsigned long zram_limit;
+
+/*
+ * Compress "page" to "slot".
+ * Return 0 if successful or return 1 if the page is not compressed well or zram
+ * is full.
+ */
+static int zram_write(struct swap_device * dev, unsigned long slot, void * page)
+{
+  unsigned long len = lz_compress((unsigned char *)page, PAGE_SIZE, zram_buffer, ZRAM_MAX_LEN);
+  unsigned char * data;
+
+  if (!len || zram_used + len > zram_limit)
+    return 1;
+  //we are in reclaim, so this never reclaim again
+  data = (unsigned char *)mm_kmalloc(len);
+  if (!data)
+    return 1;
+  memcpy(data, zram_buffer, len);
+  zram_table[slot].data = data;
+  zram_table[slot].len = len;
+  zram_used += len;
+  return 0;
+}
+
+/*
+ * Decompress "slot" to "page".
+ * Return 0 if successful or return -1 if any error.
+ */
+static int zram_read(struct swap_device * dev, unsigned long slot, void * page)
+{
+  struct zram_slot * zslot = zram_table + slot;
+
+  if (!zslot->data
+      || lz_decompress(zslot->data, zslot->len, (unsigned char *)page, PAGE_SIZE) != PAGE_SIZE)
+    return -1;
+  return 0;
+}
+
+/*
+ * Free the compressed data of "slot".
+ */
+static void zram_release(struct swap_device * dev, unsigned long slot)
+{
+  struct zram_slot * zslot = zram_table + slot;
+
+  mm_kfree(zslot->data);
+  zram_used -= zslot->len;
+  zslot->data = NULL;
+  zslot->len = 0;
+}
+
+/*
+ * Initate zram and regist it as a swap device.
+ * There is a slot for every page of memory, that is enough for 4x compression.
+ */
+void zram_init()
+{
+  unsigned long slots = pmm_total_pages();
+
+  zram_limit = slots / ZRAM_MEM_DIV * PAGE_SIZE;
+  zram_buffer = (unsigned char *)mm_kmalloc(ZRAM_MAX_LEN);
+  zram_table = (struct zram_slot *)vmalloc(slots * sizeof(struct zram_slot));
+  if (!zram_buffer || !zram_table)
+    goto error;
+  memset(zram_table, 0, slots * sizeof(struct zram_slot));
+
+  zram_device.slots = slots;
+  zram_device.write = zram_write;
+  zram_device.read = zram_read;
+  zram_device.release = zram_release;
+  if (swap_regist_device(&zram_device))
+    goto error;
+  printk("zram: %dKB\n", zram_limit / 1024);
+  return ;
+
+ error:
+  mm_kfree(zram_buffer);
+  if (zram_table)
+    vfree(zram_table);
+}